@@ -0,0 +1,352 @@
+#include<stdio.h>
+#include<stdbool.h>
+#include<string.h>
+#include<stdlib.h>
+#include<time.h>
+
+#include "merge_recordings.h"
+
+#define REORDERWINDOW 16	// records buffered per file to undo small reorderings between collectors
+#define HISTBINS 1024
+
+// Metrics found in recordings
+typedef enum RecordMetric {
+	RECORD_CPU,		// cpu use (%)
+	RECORD_MEM,		// physical memory used (% of total)
+	RECORD_USERS,	// user sessions
+	RECORD_METRICS
+} RecordMetric;
+
+static char *metricLabels[RECORD_METRICS] = {"cpu %", "mem used %", "users"};
+static float binWidths[RECORD_METRICS] = {0.1, 0.1, 1};	// HISTBINS covers 0-100% / 0-1023 sessions
+
+// Struct for storing one sample read from a recording
+typedef struct Record {
+	double timestamp;	// secs since epoch
+	RecordMetric metric;
+	float value;
+} Record;
+
+// Struct for reading one recording, holding its next few records sorted by timestamp
+typedef struct RecordingCursor {
+	FILE *file;
+	char host[64];
+	Record pending[REORDERWINDOW];
+	int pendingCount;
+	
+	// Summary of the host over the whole recording
+	double sum[RECORD_METRICS];
+	float max[RECORD_METRICS];
+	long count[RECORD_METRICS];
+} RecordingCursor;
+
+// Struct for fixed-size histograms, so percentiles take bounded memory
+typedef struct Histogram {
+	long bins[HISTBINS];
+	long count;
+	double sum;
+	float max;
+} Histogram;
+
+/*
+ * Function: addToHistogram
+ * ----------------------------
+ * Adds value to hist, clamping it to the bins available for metric
+ *
+ * returns: nothing
+ */
+void addToHistogram(Histogram *hist, RecordMetric metric, float value) {
+	int bin = (int)(value / binWidths[metric]);	// bin covers [bin, bin + 1) widths
+	if (bin < 0) bin = 0;
+	if (bin >= HISTBINS) bin = HISTBINS - 1;
+	
+	hist->bins[bin]++;
+	if (hist->count == 0 || value > hist->max) hist->max = value;
+	hist->count++;
+	hist->sum += value;
+}
+
+/*
+ * Function: getPercentile
+ * ----------------------------
+ * percentile: fraction of values (0 < percentile <= 1) to be at or below the result
+ *
+ * returns: the upper edge of the bin holding the given percentile of hist (clamped to its max,
+ *          so never below a true value at that percentile), 0 if hist is empty
+ */
+float getPercentile(Histogram *hist, RecordMetric metric, float percentile) {
+	long target = (long)(percentile * hist->count + 0.5);
+	if (target < 1) target = 1;
+	
+	long seen = 0;
+	for (int bin = 0; bin < HISTBINS; bin++) {
+		seen += hist->bins[bin];
+		if (seen >= target) return ((bin + 1) * binWidths[metric] < hist->max) ? (bin + 1) * binWidths[metric] : hist->max;
+	}
+	return 0;
+}
+
+/*
+ * Function: readRecord
+ * ----------------------------
+ * Reads lines from cursor's file until a sample line is parsed into record
+ * (picking up the host name from the header line on the way)
+ *
+ * returns: true if a record was read
+ *          false on EoF
+ */
+bool readRecord(RecordingCursor *cursor, Record *record) {
+	char line[256], metric[16];
+	float values[4];
+	
+	while (fgets(line, sizeof(line), cursor->file) != NULL) {
+		if (line[0] == '#') {
+			char *host = strstr(line, "host=");
+			if (host != NULL) sscanf(host + 5, "%63s", cursor->host);
+			continue;
+		}
+		
+		int fields = sscanf(line, "%lf %15s %f %f %f %f", &record->timestamp, metric, &values[0], &values[1], &values[2], &values[3]);
+		if (fields < 3) continue;
+		
+		if (strcmp(metric, "cpu") == 0) {
+			record->metric = RECORD_CPU;
+			record->value = values[0];
+		}
+		else if (strcmp(metric, "mem") == 0 && fields == 6) {
+			record->metric = RECORD_MEM;
+			record->value = (values[1] == 0) ? 0 : 100 * values[0] / values[1];
+		}
+		else if (strcmp(metric, "users") == 0) {
+			record->metric = RECORD_USERS;
+			record->value = values[0];
+		}
+		else continue;	// metric not merged
+		
+		return true;
+	}
+	
+	return false;
+}
+
+/*
+ * Function: fillPending
+ * ----------------------------
+ * Reads records into cursor until REORDERWINDOW are pending (or EoF),
+ * keeping them sorted by timestamp
+ *
+ * returns: nothing
+ */
+void fillPending(RecordingCursor *cursor) {
+	Record record;
+	while (cursor->pendingCount < REORDERWINDOW && readRecord(cursor, &record)) {
+		int r = cursor->pendingCount;
+		while (r > 0 && cursor->pending[r - 1].timestamp > record.timestamp) {
+			cursor->pending[r] = cursor->pending[r - 1];
+			r--;
+		}
+		cursor->pending[r] = record;
+		cursor->pendingCount++;
+	}
+}
+
+/*
+ * Function: siftDown
+ * ----------------------------
+ * Restores the min-heap (by next pending timestamp) of cursor indices in heap from index h down
+ *
+ * returns: nothing
+ */
+void siftDown(int *heap, int heapSize, RecordingCursor *cursors, int h) {
+	while (true) {
+		int least = h;
+		int left = 2 * h + 1, right = 2 * h + 2;
+		if (left < heapSize && cursors[heap[left]].pending[0].timestamp < cursors[heap[least]].pending[0].timestamp) least = left;
+		if (right < heapSize && cursors[heap[right]].pending[0].timestamp < cursors[heap[least]].pending[0].timestamp) least = right;
+		if (least == h) return;
+		
+		int tmp = heap[h];
+		heap[h] = heap[least];
+		heap[least] = tmp;
+		h = least;
+	}
+}
+
+/*
+ * Function: printBucket
+ * ----------------------------
+ * Prints a row of fleet-wide statistics for the bucket starting at bucketStart
+ *
+ * returns: nothing
+ */
+void printBucket(double bucketStart, int hostsSeen, Histogram *bucketHists) {
+	char timeStr[32];
+	time_t start = (time_t)bucketStart;
+	strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&start));
+	
+	printf("%s  %5d", timeStr, hostsSeen);
+	for (int m = 0; m < RECORD_METRICS; m++) {
+		Histogram *hist = &bucketHists[m];
+		if (hist->count == 0) printf("  %7s %7s %7s", "-", "-", "-");
+		else printf("  %7.2f %7.2f %7.2f", hist->sum / hist->count, getPercentile(hist, m, 0.95), hist->max);
+	}
+	printf("\n");
+}
+
+/*
+ * Function: printWorstHosts
+ * ----------------------------
+ * Prints the topHosts hosts with the highest average of metric
+ *
+ * returns: nothing
+ */
+void printWorstHosts(RecordingCursor *cursors, int fileCount, RecordMetric metric, int topHosts) {
+	bool *shown = calloc(fileCount, sizeof(bool));
+	if (shown == NULL) {
+		fprintf(stderr, "Error allocating memory for worst hosts\n");
+		return;
+	}
+	
+	printf(" %s:\n", metricLabels[metric]);
+	for (int n = 0; n < topHosts; n++) {
+		int worst = -1;
+		double worstAvg = 0;
+		for (int f = 0; f < fileCount; f++) {
+			if (shown[f] || cursors[f].count[metric] == 0) continue;
+			
+			double avg = cursors[f].sum[metric] / cursors[f].count[metric];
+			if (worst == -1 || avg > worstAvg) {
+				worst = f;
+				worstAvg = avg;
+			}
+		}
+		if (worst == -1) break;
+		
+		shown[worst] = true;
+		printf("  %-24s avg %7.2f  max %7.2f\n", cursors[worst].host, worstAvg, cursors[worst].max[metric]);
+	}
+	
+	free(shown);
+}
+
+/* Streams the recordings in files through a k-way merge by timestamp, printing fleet-wide statistics
+ * per aligned bucket of bucketSecs seconds, then fleet-wide percentiles and the topHosts worst hosts
+ * per metric. Memory use depends on the number of files only, not on their length.
+ * Returns: 0 on success,
+ *          -1 on error
+ */
+int mergeRecordings(char **files, int fileCount, int bucketSecs, int topHosts) {
+	if (fileCount == 0) {
+		fprintf(stderr, "merge: no recordings given\n");
+		return -1;
+	}
+	
+	RecordingCursor *cursors = calloc(fileCount, sizeof(RecordingCursor));
+	int *heap = malloc(fileCount * sizeof(int));
+	bool *bucketHosts = calloc(fileCount, sizeof(bool));
+	Histogram *fleetHists = calloc(RECORD_METRICS, sizeof(Histogram));
+	Histogram *bucketHists = calloc(RECORD_METRICS, sizeof(Histogram));
+	if (cursors == NULL || heap == NULL || bucketHosts == NULL || fleetHists == NULL || bucketHists == NULL) {
+		fprintf(stderr, "Error allocating memory for merge\n");
+		free(cursors);
+		free(heap);
+		free(bucketHosts);
+		free(fleetHists);
+		free(bucketHists);
+		return -1;
+	}
+	
+	// Open recordings and build heap of those with records
+	int heapSize = 0;
+	int result = 0;
+	for (int f = 0; f < fileCount; f++) {
+		cursors[f].file = fopen(files[f], "r");
+		if (cursors[f].file == NULL) {
+			fprintf(stderr, "merge: %s could not be opened\n", files[f]);
+			result = -1;
+			break;
+		}
+		snprintf(cursors[f].host, sizeof(cursors[f].host), "%s", files[f]);	// until header names the host
+		
+		fillPending(&cursors[f]);
+		if (cursors[f].pendingCount > 0) heap[heapSize++] = f;
+	}
+	for (int h = heapSize / 2 - 1; h >= 0 && result == 0; h--) siftDown(heap, heapSize, cursors, h);
+	
+	// Merge, printing a row whenever the next record falls past the current bucket
+	double first = -1, last = 0, bucketStart = -1;
+	int hostsSeen = 0;
+	if (result == 0) {
+		printf("### Fleet merge ### (%d recordings, buckets of %d secs, avg/p95/max per metric)\n", fileCount, bucketSecs);
+		printf("%-19s  %5s", "bucket start", "hosts");
+		for (int m = 0; m < RECORD_METRICS; m++) printf("  %-23s", metricLabels[m]);
+		printf("\n");
+	}
+	
+	while (heapSize > 0 && result == 0) {
+		int f = heap[0];
+		RecordingCursor *cursor = &cursors[f];
+		Record record = cursor->pending[0];
+		
+		// Take record off cursor and restore heap
+		cursor->pendingCount--;
+		memmove(cursor->pending, cursor->pending + 1, cursor->pendingCount * sizeof(Record));
+		fillPending(cursor);
+		if (cursor->pendingCount == 0) heap[0] = heap[--heapSize];
+		siftDown(heap, heapSize, cursors, 0);
+		
+		// Records slightly out of order (past the reorder window) stay in the current bucket
+		if (bucketStart < 0 || record.timestamp >= bucketStart + bucketSecs) {
+			if (bucketStart >= 0) printBucket(bucketStart, hostsSeen, bucketHists);
+			
+			bucketStart = (long)(record.timestamp / bucketSecs) * (double)bucketSecs;
+			memset(bucketHosts, 0, fileCount * sizeof(bool));
+			memset(bucketHists, 0, RECORD_METRICS * sizeof(Histogram));
+			hostsSeen = 0;
+		}
+		
+		if (!bucketHosts[f]) {
+			bucketHosts[f] = true;
+			hostsSeen++;
+		}
+		addToHistogram(&bucketHists[record.metric], record.metric, record.value);
+		addToHistogram(&fleetHists[record.metric], record.metric, record.value);
+		
+		cursor->sum[record.metric] += record.value;
+		if (cursor->count[record.metric] == 0 || record.value > cursor->max[record.metric]) cursor->max[record.metric] = record.value;
+		cursor->count[record.metric]++;
+		
+		if (first < 0) first = record.timestamp;
+		if (record.timestamp > last) last = record.timestamp;
+	}
+	
+	if (result == 0) {
+		if (bucketStart >= 0) printBucket(bucketStart, hostsSeen, bucketHists);
+		
+		// Fleet-wide summary
+		printf("---------------------------------------\n");
+		printf("### Fleet summary ### (%.0f secs recorded)\n", (first < 0) ? 0 : last - first);
+		for (int m = 0; m < RECORD_METRICS; m++) {
+			Histogram *hist = &fleetHists[m];
+			if (hist->count == 0) continue;
+			printf(" %-10s p50 %7.2f  p90 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f  (%ld samples)\n", metricLabels[m],
+			       getPercentile(hist, m, 0.5), getPercentile(hist, m, 0.9), getPercentile(hist, m, 0.95), getPercentile(hist, m, 0.99), hist->max, hist->count);
+		}
+		
+		printf("---------------------------------------\n");
+		printf("### Worst %d hosts ###\n", topHosts);
+		for (int m = 0; m < RECORD_METRICS; m++) printWorstHosts(cursors, fileCount, m, topHosts);
+		printf("---------------------------------------\n");
+	}
+	
+	for (int f = 0; f < fileCount; f++) {
+		if (cursors[f].file != NULL) fclose(cursors[f].file);
+	}
+	free(cursors);
+	free(heap);
+	free(bucketHosts);
+	free(fleetHists);
+	free(bucketHists);
+	
+	return result;
+}
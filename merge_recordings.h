@@ -0,0 +1,24 @@
+#include<stdio.h>
+#include<stdlib.h>
+
+#ifndef __Merge_Recordings_header
+#define __Merge_Recordings_header
+
+/* Recordings (written with --record=FILE) are text files of the form:
+ *   # system_monitor recording host=<hostname>
+ *   <timestamp> mem <physUsed> <physTot> <virtUsed> <virtTot>
+ *   <timestamp> cpu <cpuUsage>
+ *   <timestamp> users <sessions>
+ * with timestamps in secs since epoch. Each collector appends its own lines, so a file is only
+ * sorted by timestamp up to small reorderings between collectors.
+ */
+
+/* Streams the recordings in files through a k-way merge by timestamp, printing fleet-wide statistics
+ * per aligned bucket of bucketSecs seconds, then fleet-wide percentiles and the topHosts worst hosts
+ * per metric. Memory use depends on the number of files only, not on their length.
+ * Returns: 0 on success,
+ *          -1 on error
+ */
+int mergeRecordings(char **files, int fileCount, int bucketSecs, int topHosts);
+
+#endif
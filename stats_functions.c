@@ -11,16 +11,1702 @@
 #include<unistd.h>
 #include<signal.h>
 #include<sys/wait.h>
+#include<time.h>
+#include<errno.h>
+#include<ctype.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<pwd.h>
+#include<sys/stat.h>
+#include<sys/sysmacros.h>
+#include<sys/socket.h>
+#include<arpa/inet.h>
+#include<poll.h>
+#include<linux/netlink.h>
+#include<linux/connector.h>
+#include<linux/cn_proc.h>
 
 #define MAXSIZE 4096
 #define GiB 1073741824
 
-/* Writes 4 memory statistics (system-wide) to the FD given by writeFD.
- * Writes in the order: float physUsed, float physTot, float virtUsed, float virtTot (all in GiB)
+#include "stats_functions.h"
+
+/* Initializes ad to sample every maxDelay seconds until a change of at least threshold is seen.
+ * Prereq: 0 < minDelay <= maxDelay
+ */
+void initAdaptiveDelay(AdaptiveDelay *ad, double minDelay, double maxDelay, float threshold) {
+	ad->minDelay = minDelay;
+	ad->maxDelay = maxDelay;
+	ad->threshold = threshold;
+	ad->curDelay = maxDelay;
+	ad->lastValue = 0;
+	ad->hasLast = false;
+}
+
+/* Feeds the latest sample value into ad and returns the delay (secs) before the next sample.
+ * Halves the delay when the value moved by at least ad->threshold since the last sample,
+ * otherwise grows it by 25%, always staying within [minDelay, maxDelay].
+ */
+double nextAdaptiveDelay(AdaptiveDelay *ad, float value) {
+	if (ad->hasLast && fabsf(value - ad->lastValue) >= ad->threshold) ad->curDelay /= 2;
+	else if (ad->hasLast) ad->curDelay *= 1.25;
+	
+	if (ad->curDelay < ad->minDelay) ad->curDelay = ad->minDelay;
+	if (ad->curDelay > ad->maxDelay) ad->curDelay = ad->maxDelay;
+	
+	ad->lastValue = value;
+	ad->hasLast = true;
+	return ad->curDelay;
+}
+
+/* Returns the current wall-clock time in seconds since the epoch. */
+double getTimestamp() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Sleeps for the given (possibly fractional) amount of seconds, resuming after signals. */
+void sleepFor(double seconds) {
+	if (seconds <= 0) return;
+	
+	struct timespec req, rem;
+	req.tv_sec = (time_t)seconds;
+	req.tv_nsec = (long)((seconds - (double)req.tv_sec) * 1e9);
+	
+	// Keep sleeping for the remaining time if interrupted (e.g. stopped and continued by SIGINT handler)
+	while (nanosleep(&req, &rem) == -1 && errno == EINTR) req = rem;
+}
+
+/* Parses a value with an optional unit (%, KiB, MiB or GiB) at *tr, advancing *tr past it.
+ * Memory values are converted to GiB.
+ * Returns: 0 on success, 
+ *          -1 on error (no value at *tr)
+ */
+int parseAlertValue(char **tr, float *value) {
+	char *leftover;
+	while (isspace(**tr)) (*tr)++;
+	*value = strtof(*tr, &leftover);
+	if (leftover == *tr) return -1;
+	*tr = leftover;
+	
+	if (strncmp(*tr, "GiB", 3) == 0) *tr += 3;
+	else if (strncmp(*tr, "MiB", 3) == 0) {
+		*value /= 1024;
+		*tr += 3;
+	}
+	else if (strncmp(*tr, "KiB", 3) == 0) {
+		*value /= 1024 * 1024;
+		*tr += 3;
+	}
+	else if (**tr == '%') (*tr)++;
+	
+	return 0;
+}
+
+/* Compiles the rule in text and appends it to set.
+ * Format: <metric><op><value>[unit] [for <duration>] [clear <value>[unit]]
+ *         op is one of >, >=, <, <=; unit is one of %, KiB, MiB, GiB; duration is given in ms, s or m.
+ * Without a clear value, the rule clears once the value is 5% back past its level.
+ * Returns: 0 on success, 
+ *          -1 on error (invalid rule or set is full)
+ */
+int compileAlertRule(AlertSet *set, char *text) {
+	static const char *metricNames[] = {"cpu", "mem.used", "mem.avail", "mem.pct", "virt.used", "users"};
+	
+	if (set->count >= MAXALERTS) {
+		fprintf(stderr, "alert: only a maximum of %d rules can be given\n", MAXALERTS);
+		return -1;
+	}
+	
+	AlertRule rule;
+	memset(&rule, 0, sizeof(AlertRule));
+	rule.pendingSince = -1;
+	snprintf(rule.text, sizeof(rule.text), "%s", text);
+	
+	// Metric name (longest matching name wins)
+	char *tr = text;
+	while (isspace(*tr)) tr++;
+	int metricLen = 0;
+	for (int m = 0; m < sizeof(metricNames) / sizeof(metricNames[0]); m++) {
+		int len = strlen(metricNames[m]);
+		if (strncmp(tr, metricNames[m], len) == 0 && len > metricLen) {
+			rule.metric = m;
+			metricLen = len;
+		}
+	}
+	if (metricLen == 0) {
+		fprintf(stderr, "alert: unknown metric in rule \"%s\"\n", text);
+		return -1;
+	}
+	tr += metricLen;
+	while (isspace(*tr)) tr++;
+	
+	// Comparison
+	if (*tr != '>' && *tr != '<') {
+		fprintf(stderr, "alert: expected '>' or '<' in rule \"%s\"\n", text);
+		return -1;
+	}
+	rule.above = (*tr == '>');
+	tr++;
+	if (*tr == '=') {
+		rule.inclusive = true;
+		tr++;
+	}
+	
+	// Level, then the optional "for" and "clear" clauses
+	bool sawClear = false;
+	if (parseAlertValue(&tr, &rule.level) == -1) {
+		fprintf(stderr, "alert: expected a value in rule \"%s\"\n", text);
+		return -1;
+	}
+	
+	while (*tr != '\0') {
+		while (isspace(*tr)) tr++;
+		
+		if (strncmp(tr, "for", 3) == 0 && isspace(tr[3])) {
+			char *leftover;
+			tr += 3;
+			rule.holdTime = strtod(tr, &leftover);
+			if (leftover == tr || rule.holdTime < 0) break;
+			tr = leftover;
+			
+			if (strncmp(tr, "ms", 2) == 0) {
+				rule.holdTime /= 1000;
+				tr += 2;
+			}
+			else if (*tr == 'm') {
+				rule.holdTime *= 60;
+				tr++;
+			}
+			else if (*tr == 's') tr++;
+		}
+		else if (strncmp(tr, "clear", 5) == 0 && isspace(tr[5])) {
+			tr += 5;
+			if (parseAlertValue(&tr, &rule.clearLevel) == -1) break;
+			sawClear = true;
+		}
+		else break;
+	}
+	if (*tr != '\0') {
+		fprintf(stderr, "alert: could not parse \"%s\" in rule \"%s\"\n", tr, text);
+		return -1;
+	}
+	
+	// Default hysteresis of 5% of the level
+	if (!sawClear) rule.clearLevel = rule.above ? rule.level - fabsf(rule.level) * 0.05 : rule.level + fabsf(rule.level) * 0.05;
+	if ((rule.above && rule.clearLevel > rule.level) || (!rule.above && rule.clearLevel < rule.level)) {
+		fprintf(stderr, "alert: clear value must not be past the alert value in rule \"%s\"\n", text);
+		return -1;
+	}
+	
+	set->rules[set->count] = rule;
+	set->count++;
+	set->metrics |= 1u << rule.metric;
+	return 0;
+}
+
+/* Reports a rule firing or clearing: runs the hook and/or appends an event record (see checkAlerts). */
+void reportAlert(AlertSet *set, AlertRule *rule, float value, double timestamp) {
+	char record[MAXSIZE];
+	int len = snprintf(record, MAXSIZE, "%.3f %s %s (value %.2f)\n", timestamp, rule->firing ? "FIRING" : "CLEARED", rule->text, value);
+	if (len >= MAXSIZE) len = MAXSIZE - 1;
+	
+	if (set->logFD != -1 || set->hook == NULL) {
+		if (write((set->logFD != -1) ? set->logFD : STDERR_FILENO, record, len) == -1) perror("write");
+	}
+	
+	if (set->hook != NULL) {
+		// Reap hooks from earlier alerts that have finished
+		while (waitpid(-1, NULL, WNOHANG) > 0);
+		
+		pid_t hookPid = fork();
+		if (hookPid == 0) {
+			char valueStr[32], timeStr[32];
+			snprintf(valueStr, sizeof(valueStr), "%.2f", value);
+			snprintf(timeStr, sizeof(timeStr), "%.3f", timestamp);
+			setenv("ALERT_STATE", rule->firing ? "FIRING" : "CLEARED", 1);
+			setenv("ALERT_RULE", rule->text, 1);
+			setenv("ALERT_VALUE", valueStr, 1);
+			setenv("ALERT_TIME", timeStr, 1);
+			
+			// Own process group, so pausing/quitting the monitor doesn't signal the hook
+			setpgid(0, 0);
+			execl("/bin/sh", "sh", "-c", set->hook, (char *)NULL);
+			perror("execl");
+			_exit(127);
+		}
+		else if (hookPid < 0) perror("fork");
+	}
+}
+
+/* Checks a new sample of metric against every rule in set, reporting rules that fire or clear.
+ * A fired/cleared rule runs set->hook (with ALERT_STATE, ALERT_RULE, ALERT_VALUE and ALERT_TIME in its
+ * environment) and appends an event record to set->logFD; if neither is set the record goes to stderr.
+ */
+void checkAlerts(AlertSet *set, AlertMetric metric, float value, double timestamp) {
+	if (!(set->metrics & (1u << metric))) return;
+	
+	for (int r = 0; r < set->count; r++) {
+		AlertRule *rule = &set->rules[r];
+		if (rule->metric != metric) continue;
+		
+		if (!rule->firing) {
+			bool holds = rule->above ? (value > rule->level || (rule->inclusive && value == rule->level))
+			                         : (value < rule->level || (rule->inclusive && value == rule->level));
+			if (!holds) {
+				rule->pendingSince = -1;
+				continue;
+			}
+			
+			if (rule->pendingSince < 0) rule->pendingSince = timestamp;
+			if (timestamp - rule->pendingSince >= rule->holdTime) {
+				rule->firing = true;
+				reportAlert(set, rule, value, timestamp);
+			}
+		}
+		else {
+			bool holds = rule->above ? (value > rule->level || (rule->inclusive && value == rule->level))
+			                         : (value < rule->level || (rule->inclusive && value == rule->level));
+			bool cleared = !holds && (rule->above ? value <= rule->clearLevel : value >= rule->clearLevel);
+			if (cleared) {
+				rule->firing = false;
+				rule->pendingSince = -1;
+				reportAlert(set, rule, value, timestamp);
+			}
+		}
+	}
+}
+
+/* Initializes an empty table of entries of entrySize bytes, each starting with a pid_t.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initPidTable(PidTable *table, size_t entrySize) {
+	table->entrySize = entrySize;
+	table->capacity = 1024;
+	table->count = 0;
+	table->entries = calloc(table->capacity, entrySize);
+	if (table->entries == NULL) {
+		fprintf(stderr, "Error allocating memory for pid table\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns the entry at idx of table. */
+void *getPidEntry(PidTable *table, int idx) {
+	return (char *)table->entries + (size_t)idx * table->entrySize;
+}
+
+/* Returns the index pid hashes to in table. */
+int getPidHome(PidTable *table, pid_t pid) {
+	return (int)(((unsigned int)pid * 2654435761u) & (table->capacity - 1));
+}
+
+/* Returns the index of pid's entry in table, or of the empty entry it would be inserted at. */
+int findPidEntry(PidTable *table, pid_t pid) {
+	int idx = getPidHome(table, pid);
+	while (*(pid_t *)getPidEntry(table, idx) != 0 && *(pid_t *)getPidEntry(table, idx) != pid) idx = (idx + 1) & (table->capacity - 1);
+	return idx;
+}
+
+/* Empties the entry at idx, shifting back later entries of its probe sequence to keep them findable. */
+void removePidEntry(PidTable *table, int idx) {
+	int mask = table->capacity - 1;
+	int hole = idx;
+	*(pid_t *)getPidEntry(table, hole) = 0;
+	table->count--;
+	
+	for (int j = (hole + 1) & mask; *(pid_t *)getPidEntry(table, j) != 0; j = (j + 1) & mask) {
+		int home = getPidHome(table, *(pid_t *)getPidEntry(table, j));
+		
+		// Entry can fill the hole if its home isn't cyclically within (hole, j]
+		bool homeBetween = (hole <= j) ? (home > hole && home <= j) : (home > hole || home <= j);
+		if (!homeBetween) {
+			memcpy(getPidEntry(table, hole), getPidEntry(table, j), table->entrySize);
+			*(pid_t *)getPidEntry(table, j) = 0;
+			hole = j;
+		}
+	}
+}
+
+/* Makes room for one more entry in table, doubling its capacity once it is half full.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int reservePidEntry(PidTable *table) {
+	if ((table->count + 1) * 2 <= table->capacity) return 0;
+	
+	PidTable old = *table;
+	table->capacity *= 2;
+	table->entries = calloc(table->capacity, table->entrySize);
+	if (table->entries == NULL) {
+		fprintf(stderr, "Error allocating memory for pid table\n");
+		*table = old;
+		return -1;
+	}
+	
+	for (int i = 0; i < old.capacity; i++) {
+		pid_t pid = *(pid_t *)getPidEntry(&old, i);
+		if (pid != 0) memcpy(getPidEntry(table, findPidEntry(table, pid)), getPidEntry(&old, i), table->entrySize);
+	}
+	free(old.entries);
+	return 0;
+}
+
+/* Frees memory held by table. */
+void freePidTable(PidTable *table) {
+	free(table->entries);
+	table->entries = NULL;
+}
+
+/* Initializes an empty table.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initUserUsage(UserUsageTable *table) {
+	memset(table, 0, sizeof(UserUsageTable));
+	return initPidTable(&table->pids, sizeof(PidUsage));
+}
+
+/* Returns the index of uid's slot in table (adding one if needed, or reusing one whose processes have all exited),
+ * or -1 if the table is full.
+ */
+int getUserSlot(UserUsageTable *table, uid_t uid) {
+	int freeSlot = -1;
+	for (int s = 0; s < table->slotCount; s++) {
+		if (table->slots[s].uid == uid) return s;
+		
+		// No pid refers to a slot without processes, so it can be reused once it has no cpu time left to show
+		if (freeSlot == -1 && table->slots[s].procs == 0 && table->slots[s].cpuTicks == 0) freeSlot = s;
+	}
+	if (freeSlot == -1 && table->slotCount == MAXUSERSLOTS) return -1;
+	if (freeSlot == -1) freeSlot = table->slotCount++;
+	
+	UserSlot *slot = &table->slots[freeSlot];
+	memset(slot, 0, sizeof(UserSlot));
+	slot->uid = uid;
+	struct passwd *pw = getpwuid(uid);
+	if (pw != NULL) snprintf(slot->name, sizeof(slot->name), "%s", pw->pw_name);
+	else snprintf(slot->name, sizeof(slot->name), "%d", uid);
+	
+	return freeSlot;
+}
+
+/* Scans every /proc/[pid]/status and stat once, applying the change in each process' cpu time, RSS and threads
+ * (and processes that started or exited) to the totals of its real uid.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int updateUserUsage(UserUsageTable *table) {
+	DIR *proc = opendir("/proc");
+	if (proc == NULL) {
+		fprintf(stderr, "error: /proc could not be opened\n");
+		return -1;
+	}
+	
+	double now = getTimestamp();
+	table->scans++;
+	for (int s = 0; s < table->slotCount; s++) table->slots[s].cpuTicks = 0;
+	table->ttyCount = 0;
+	
+	struct dirent *entry;
+	while ((entry = readdir(proc)) != NULL) {
+		if (!isdigit(entry->d_name[0])) continue;
+		
+		// Real uid from the "Uid:" line of status (the owner of /proc/[pid] is root for non-dumpable processes)
+		char path[300], buf[2048];
+		snprintf(path, sizeof(path), "/proc/%s/status", entry->d_name);
+		int fd = open(path, O_RDONLY);
+		if (fd == -1) continue;		// process exited since readdir
+		
+		ssize_t len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (len <= 0) continue;
+		buf[len] = '\0';
+		
+		char *uidLine = strstr(buf, "\nUid:");
+		uid_t uid;
+		if (uidLine == NULL || sscanf(uidLine, "\nUid: %u", &uid) != 1) continue;
+		
+		// CPU ticks, rss, threads etc. from stat
+		snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+		fd = open(path, O_RDONLY);
+		if (fd == -1) continue;
+		
+		len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (len <= 0) continue;
+		buf[len] = '\0';
+		
+		// Process name may contain spaces/parentheses, so fields are parsed from after the last ')'
+		char *fields = strrchr(buf, ')');
+		int ttyNr, threads;
+		unsigned long utime, stime;
+		unsigned long long startTime;
+		long rssPages;
+		if (fields == NULL || sscanf(fields + 1, " %*c %*d %*d %*d %d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %d %*d %llu %*u %ld",
+		                             &ttyNr, &utime, &stime, &threads, &startTime, &rssPages) != 6) continue;
+		
+		pid_t pid = atoi(entry->d_name);
+		unsigned long cpuTicks = utime + stime;
+		
+		if (reservePidEntry(&table->pids) == -1) {
+			closedir(proc);
+			return -1;
+		}
+		
+		PidUsage *usage = getPidEntry(&table->pids, findPidEntry(&table->pids, pid));
+		
+		// Known process: only apply what changed since the last scan
+		if (usage->pid == pid && usage->startTime == startTime && table->slots[usage->slot].uid == uid) {
+			UserSlot *slot = &table->slots[usage->slot];
+			if (cpuTicks > usage->cpuTicks) slot->cpuTicks += cpuTicks - usage->cpuTicks;
+			slot->rssPages += rssPages - usage->rssPages;
+			slot->threads += threads - usage->threads;
+		}
+		// New process (or pid reused / uid changed since the last scan)
+		else {
+			int slotIdx = getUserSlot(table, uid);
+			if (slotIdx == -1) continue;	// stale entry (if any) is dropped in the sweep below
+			
+			if (usage->pid == pid) {
+				UserSlot *oldSlot = &table->slots[usage->slot];
+				oldSlot->rssPages -= usage->rssPages;
+				oldSlot->threads -= usage->threads;
+				oldSlot->procs--;
+			}
+			else table->pids.count++;
+			
+			UserSlot *slot = &table->slots[slotIdx];
+			slot->procs++;
+			slot->rssPages += rssPages;
+			slot->threads += threads;
+			if (table->scans > 1) slot->cpuTicks += cpuTicks;	// started since the last scan
+			
+			usage->pid = pid;
+			usage->slot = slotIdx;
+			usage->startTime = startTime;
+		}
+		usage->cpuTicks = cpuTicks;
+		usage->rssPages = rssPages;
+		usage->threads = threads;
+		usage->seen = table->scans;
+		
+		// Count processes attached to each tty
+		if (ttyNr != 0) {
+			dev_t tty = makedev((ttyNr >> 8) & 0xfff, (ttyNr & 0xff) | ((ttyNr >> 12) & 0xfff00));
+			int t = 0;
+			while (t < table->ttyCount && table->ttys[t] != tty) t++;
+			if (t == table->ttyCount && t < MAXUSERSLOTS) {
+				table->ttys[t] = tty;
+				table->ttyProcs[t] = 0;
+				table->ttyCount++;
+			}
+			if (t < table->ttyCount) table->ttyProcs[t]++;
+		}
+	}
+	closedir(proc);
+	
+	// Remove processes that exited since the last scan
+	for (int i = 0; i < table->pids.capacity;) {
+		PidUsage *usage = getPidEntry(&table->pids, i);
+		if (usage->pid == 0 || usage->seen == table->scans) {
+			i++;
+			continue;
+		}
+		
+		UserSlot *slot = &table->slots[usage->slot];
+		slot->rssPages -= usage->rssPages;
+		slot->threads -= usage->threads;
+		slot->procs--;
+		removePidEntry(&table->pids, i);	// an entry may be shifted into i, so check i again
+	}
+	
+	table->interval = (table->scans > 1) ? now - table->lastScan : 0;
+	table->lastScan = now;
+	return 0;
+}
+
+/* Frees memory held by table. */
+void freeUserUsage(UserUsageTable *table) {
+	freePidTable(&table->pids);
+}
+
+/* Returns the cpu use (%, 100% being one core) of slot over the last scan interval of table. */
+float getUserCpuUse(UserUsageTable *table, UserSlot *slot) {
+	if (table->interval <= 0) return 0;
+	return 100 * (float)slot->cpuTicks / (sysconf(_SC_CLK_TCK) * table->interval);
+}
+
+/* Returns the time in seconds since boot (same clock as proc connector event timestamps). */
+double getUptimeTimestamp() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Subscribes to fork/exec/exit events from the kernel's netlink proc connector.
+ * Returns: socket FD to receive events from on success, 
+ *          -1 on error (e.g. connector unavailable or not privileged)
+ */
+int openProcConnector() {
+	int connFD = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (connFD == -1) return -1;
+	
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = getpid();
+	if (bind(connFD, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(connFD);
+		return -1;
+	}
+	
+	// Ask the connector to start multicasting process events
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	char msg[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))] __attribute__((aligned(NLMSG_ALIGNTO)));
+	memset(msg, 0, sizeof(msg));
+	
+	struct nlmsghdr *header = (struct nlmsghdr *)msg;
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	header->nlmsg_type = NLMSG_DONE;
+	header->nlmsg_pid = getpid();
+	
+	struct cn_msg *cn = NLMSG_DATA(header);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+	
+	if (send(connFD, msg, header->nlmsg_len, 0) == -1) {
+		close(connFD);
+		return -1;
+	}
+	
+	// Bursts of short-lived processes shouldn't overflow the socket (not fatal if refused)
+	int bufSize = 1 << 20;
+	setsockopt(connFD, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+	
+	return connFD;
+}
+
+/* Brings live (a PidTable of LiveProc) in line with the pids in /proc.
+ * If sample is not NULL, new pids are counted as forks and missing ones as exits.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int rescanLiveProcs(PidTable *live, ProcEventSample *sample) {
+	static unsigned int scans = 0;
+	
+	DIR *proc = opendir("/proc");
+	if (proc == NULL) {
+		fprintf(stderr, "error: /proc could not be opened\n");
+		return -1;
+	}
+	
+	double now = getUptimeTimestamp();
+	scans++;
+	
+	struct dirent *entry;
+	while ((entry = readdir(proc)) != NULL) {
+		if (!isdigit(entry->d_name[0])) continue;
+		
+		pid_t pid = atoi(entry->d_name);
+		if (reservePidEntry(live) == -1) {
+			closedir(proc);
+			return -1;
+		}
+		
+		LiveProc *liveProc = getPidEntry(live, findPidEntry(live, pid));
+		if (liveProc->pid != pid) {
+			liveProc->pid = pid;
+			liveProc->forkTime = (sample != NULL) ? now : -1;
+			live->count++;
+			if (sample != NULL) sample->forks++;
+		}
+		liveProc->seen = scans;
+	}
+	closedir(proc);
+	
+	// Remove processes that exited
+	for (int i = 0; i < live->capacity;) {
+		LiveProc *liveProc = getPidEntry(live, i);
+		if (liveProc->pid == 0 || liveProc->seen == scans) {
+			i++;
+			continue;
+		}
+		
+		if (sample != NULL) {
+			sample->exits++;
+			if (liveProc->forkTime >= 0 && now - liveProc->forkTime < SHORTLIVED) sample->shortLived++;
+		}
+		removePidEntry(live, i);	// an entry may be shifted into i, so check i again
+	}
+	
+	return 0;
+}
+
+/* Initializes live (a PidTable of LiveProc) with every process currently in /proc.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initLiveProcs(PidTable *live) {
+	if (initPidTable(live, sizeof(LiveProc)) == -1) return -1;
+	return rescanLiveProcs(live, NULL);
+}
+
+/* Applies one proc connector event (copied out of its message, see writeProcEventDataToPipe) to live and counts it in sample. */
+void handleProcEvent(struct proc_event *event, PidTable *live, ProcEventSample *sample) {
+	double eventTime = (double)event->timestamp_ns / 1e9;
+	
+	if (event->what == PROC_EVENT_FORK) {
+		// Threads share their creator's tgid
+		if (event->event_data.fork.child_pid != event->event_data.fork.child_tgid) {
+			sample->threads++;
+			return;
+		}
+		
+		sample->forks++;
+		if (reservePidEntry(live) == -1) return;
+		LiveProc *liveProc = getPidEntry(live, findPidEntry(live, event->event_data.fork.child_pid));
+		if (liveProc->pid == 0) live->count++;
+		liveProc->pid = event->event_data.fork.child_pid;
+		liveProc->forkTime = eventTime;
+	}
+	else if (event->what == PROC_EVENT_EXEC) sample->execs++;
+	else if (event->what == PROC_EVENT_EXIT) {
+		if (event->event_data.exit.process_pid != event->event_data.exit.process_tgid) return;
+		
+		sample->exits++;
+		int idx = findPidEntry(live, event->event_data.exit.process_pid);
+		LiveProc *liveProc = getPidEntry(live, idx);
+		if (liveProc->pid == 0) return;
+		
+		if (liveProc->forkTime >= 0 && eventTime - liveProc->forkTime < SHORTLIVED) sample->shortLived++;
+		removePidEntry(live, idx);
+	}
+}
+
+/* Writes a ProcEventSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Events are read from connFD (see openProcConnector), or if connFD is -1, /proc is rescanned after
+ * delayTime seconds and new/missing pids are counted as forks/exits.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeProcEventDataToPipe(int connFD, PidTable *live, double delayTime, int writeFD) {
+	ProcEventSample sample;
+	memset(&sample, 0, sizeof(ProcEventSample));
+	sample.interval = delayTime;
+	
+	// Fall back to polling
+	if (connFD == -1) {
+		sleepFor(delayTime);
+		sample.polled = true;
+		if (rescanLiveProcs(live, &sample) == -1) return -1;
+	}
+	
+	// Apply events as they come in until delayTime has passed
+	double deadline = getTimestamp() + delayTime;
+	double remaining;
+	while (connFD != -1 && (remaining = deadline - getTimestamp()) > 0) {
+		struct pollfd pollConn = {connFD, POLLIN, 0};
+		int pollRes = poll(&pollConn, 1, (int)(remaining * 1000) + 1);
+		if (pollRes == 0) break;
+		if (pollRes == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			return -1;
+		}
+		
+		char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+		ssize_t len = recv(connFD, buf, sizeof(buf), 0);
+		if (len == -1) {
+			if (errno == EINTR) continue;
+			
+			// Events were dropped, so resync the live processes from /proc
+			if (errno == ENOBUFS) {
+				if (rescanLiveProcs(live, NULL) == -1) return -1;
+				continue;
+			}
+			perror("recv");
+			return -1;
+		}
+		
+		for (struct nlmsghdr *header = (struct nlmsghdr *)buf; NLMSG_OK(header, len); header = NLMSG_NEXT(header, len)) {
+			if (header->nlmsg_type == NLMSG_NOOP || header->nlmsg_type == NLMSG_ERROR) continue;
+			
+			struct cn_msg *cn = NLMSG_DATA(header);
+			if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+			
+			// cn->data is only 4-byte aligned, so the event is copied out before its 64-bit fields are read
+			struct proc_event event;
+			memset(&event, 0, sizeof(struct proc_event));
+			memcpy(&event, cn->data, cn->len < sizeof(struct proc_event) ? cn->len : sizeof(struct proc_event));
+			handleProcEvent(&event, live, &sample);
+		}
+	}
+	
+	sample.timestamp = getTimestamp();
+	sample.live = live->count;
+	
+	// Write sample to pipe
+	if (write(writeFD, &sample, sizeof(ProcEventSample)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+// 4 counters processed at once when computing interrupt deltas
+typedef unsigned long long CounterVec __attribute__((vector_size(4 * sizeof(unsigned long long))));
+
+/* Reads the whole file at fd (from offset 0) into *buf, growing *buf (of *bufSize bytes) as needed.
+ * Returns: number of bytes read on success, 
+ *          -1 on error
+ */
+ssize_t readWholeFile(int fd, char **buf, size_t *bufSize) {
+	size_t len = 0;
+	while (true) {
+		if (len + 1 >= *bufSize) {
+			char *grown = realloc(*buf, *bufSize * 2);
+			if (grown == NULL) {
+				fprintf(stderr, "Error allocating memory for file buffer\n");
+				return -1;
+			}
+			*buf = grown;
+			*bufSize *= 2;
+		}
+		
+		ssize_t bytes = pread(fd, *buf + len, *bufSize - len - 1, len);
+		if (bytes == -1 && errno == EINTR) continue;
+		if (bytes == -1) {
+			perror("pread");
+			return -1;
+		}
+		if (bytes == 0) break;
+		len += bytes;
+	}
+	
+	(*buf)[len] = '\0';
+	return len;
+}
+
+/* Grows the row capacity of matrix to at least rows.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int growIrqMatrix(IrqMatrix *matrix, int rows) {
+	if (rows <= matrix->rowCapacity) return 0;
+	
+	size_t cells = (size_t)rows * matrix->cpus;
+	char (*labels)[16] = realloc(matrix->labels, rows * sizeof(*labels));
+	if (labels != NULL) matrix->labels = labels;
+	char (*names)[32] = realloc(matrix->names, rows * sizeof(*names));
+	if (names != NULL) matrix->names = names;
+	unsigned long long *counts = realloc(matrix->counts, cells * sizeof(unsigned long long));
+	if (counts != NULL) matrix->counts = counts;
+	unsigned long long *prev = realloc(matrix->prev, cells * sizeof(unsigned long long));
+	if (prev != NULL) matrix->prev = prev;
+	unsigned long long *deltas = realloc(matrix->deltas, cells * sizeof(unsigned long long));
+	if (deltas != NULL) matrix->deltas = deltas;
+	
+	if (labels == NULL || names == NULL || counts == NULL || prev == NULL || deltas == NULL) {
+		fprintf(stderr, "Error allocating memory for interrupt counters\n");
+		return -1;
+	}
+	
+	// New rows have no identity yet
+	for (int r = matrix->rowCapacity; r < rows; r++) matrix->labels[r][0] = '\0';
+	matrix->rowCapacity = rows;
+	return 0;
+}
+
+/* Re-reads the counters of matrix in one linear pass over its file, keeping the previous ones in matrix->prev.
+ * Rows that are new (or changed label) get their previous counts set to the current ones.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int readIrqMatrix(IrqMatrix *matrix) {
+	if (readWholeFile(matrix->fd, &matrix->buf, &matrix->bufSize) == -1) return -1;
+	
+	// Header line has one "CPU<n>" column per cpu (read once, cpus going offline don't reshape the matrix)
+	char *tr = matrix->buf;
+	char *lineEnd = strchr(tr, '\n');
+	if (lineEnd == NULL) return -1;
+	if (matrix->cpus == 0) {
+		for (char *col = strstr(tr, "CPU"); col != NULL && col < lineEnd; col = strstr(col + 3, "CPU")) matrix->cpus++;
+		if (matrix->cpus == 0) return -1;
+		
+		int lines = 0;
+		for (char *c = lineEnd; c != NULL; c = strchr(c + 1, '\n')) lines++;
+		if (growIrqMatrix(matrix, lines) == -1) return -1;
+	}
+	tr = lineEnd + 1;
+	
+	unsigned long long *swap = matrix->prev;
+	matrix->prev = matrix->counts;
+	matrix->counts = swap;
+	
+	int r = 0;
+	while (*tr != '\0') {
+		lineEnd = strchr(tr, '\n');
+		if (lineEnd == NULL) lineEnd = tr + strlen(tr);
+		
+		while (*tr == ' ') tr++;
+		char *colon = memchr(tr, ':', lineEnd - tr);
+		if (colon == NULL) {
+			tr = (*lineEnd == '\0') ? lineEnd : lineEnd + 1;
+			continue;
+		}
+		if (r == matrix->rowCapacity && growIrqMatrix(matrix, matrix->rowCapacity * 2) == -1) return -1;
+		
+		// Per-cpu counts (rows such as ERR/MIS only have one)
+		unsigned long long *row = matrix->counts + (size_t)r * matrix->cpus;
+		char *num = colon + 1;
+		int c = 0;
+		for (; c < matrix->cpus; c++) {
+			while (*num == ' ') num++;
+			if (!isdigit(*num)) break;
+			row[c] = strtoull(num, &num, 10);
+		}
+		for (; c < matrix->cpus; c++) row[c] = 0;
+		
+		// Resolve the row's name only when it is first seen at this position
+		int labelLen = (colon - tr < 15) ? colon - tr : 15;
+		if (r >= matrix->rows || strncmp(matrix->labels[r], tr, labelLen) != 0 || matrix->labels[r][labelLen] != '\0') {
+			memcpy(matrix->labels[r], tr, labelLen);
+			matrix->labels[r][labelLen] = '\0';
+			
+			// Numbered IRQs are named after their device (last word), others after their description
+			while (*num == ' ') num++;
+			char *desc = num;
+			if (isdigit(matrix->labels[r][0])) {
+				for (char *d = num; d < lineEnd; d++) {
+					if (*d == ' ' && d + 1 < lineEnd && d[1] != ' ') desc = d + 1;
+				}
+			}
+			if (desc < lineEnd) snprintf(matrix->names[r], sizeof(matrix->names[r]), "%s %.*s", matrix->labels[r], (int)(lineEnd - desc), desc);
+			else snprintf(matrix->names[r], sizeof(matrix->names[r]), "%s", matrix->labels[r]);
+			
+			memcpy(matrix->prev + (size_t)r * matrix->cpus, row, matrix->cpus * sizeof(unsigned long long));
+		}
+		
+		r++;
+		tr = (*lineEnd == '\0') ? lineEnd : lineEnd + 1;
+	}
+	matrix->rows = r;
+	
+	return 0;
+}
+
+/* Opens the interrupt counters file at path and reads a first baseline into matrix.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initIrqMatrix(IrqMatrix *matrix, char *path) {
+	memset(matrix, 0, sizeof(IrqMatrix));
+	matrix->fd = open(path, O_RDONLY);
+	if (matrix->fd == -1) {
+		fprintf(stderr, "error: %s could not be opened\n", path);
+		return -1;
+	}
+	
+	matrix->bufSize = 1 << 16;
+	matrix->buf = malloc(matrix->bufSize);
+	if (matrix->buf == NULL) {
+		fprintf(stderr, "Error allocating memory for file buffer\n");
+		return -1;
+	}
+	
+	return readIrqMatrix(matrix);
+}
+
+/* Frees memory held by (and closes the file of) matrix. */
+void freeIrqMatrix(IrqMatrix *matrix) {
+	if (matrix->fd != -1) close(matrix->fd);
+	free(matrix->buf);
+	free(matrix->labels);
+	free(matrix->names);
+	free(matrix->counts);
+	free(matrix->prev);
+	free(matrix->deltas);
+}
+
+/* Computes matrix->deltas = counts - prev, 4 counters at a time (counters that went backwards give 0).
+ * Returns: the sum of all deltas
+ */
+unsigned long long computeIrqDeltas(IrqMatrix *matrix) {
+	size_t cells = (size_t)matrix->rows * matrix->cpus;
+	CounterVec sum = {0, 0, 0, 0};
+	size_t i = 0;
+	
+	for (; i + 4 <= cells; i += 4) {
+		CounterVec cur, prev;
+		memcpy(&cur, matrix->counts + i, sizeof(CounterVec));
+		memcpy(&prev, matrix->prev + i, sizeof(CounterVec));
+		
+		CounterVec delta = (cur - prev) & (CounterVec)(cur >= prev);
+		memcpy(matrix->deltas + i, &delta, sizeof(CounterVec));
+		sum += delta;
+	}
+	
+	unsigned long long total = sum[0] + sum[1] + sum[2] + sum[3];
+	for (; i < cells; i++) {
+		matrix->deltas[i] = (matrix->counts[i] >= matrix->prev[i]) ? matrix->counts[i] - matrix->prev[i] : 0;
+		total += matrix->deltas[i];
+	}
+	return total;
+}
+
+/* Adds the IRQ/cpu pairs of matrix that are hotter than those in sample->top, keeping it sorted hottest first. */
+void addIrqHotspots(IrqMatrix *matrix, double interval, IrqSample *sample) {
+	size_t cells = (size_t)matrix->rows * matrix->cpus;
+	
+	for (size_t i = 0; i < cells; i++) {
+		if (matrix->deltas[i] == 0) continue;
+		
+		float rate = matrix->deltas[i] / interval;
+		if (sample->count == TOPIRQS && rate <= sample->top[TOPIRQS - 1].rate) continue;
+		
+		int pos = (sample->count < TOPIRQS) ? sample->count++ : TOPIRQS - 1;
+		while (pos > 0 && sample->top[pos - 1].rate < rate) {
+			sample->top[pos] = sample->top[pos - 1];
+			pos--;
+		}
+		
+		snprintf(sample->top[pos].name, sizeof(sample->top[pos].name), "%s", matrix->names[i / matrix->cpus]);
+		sample->top[pos].cpu = i % matrix->cpus;
+		sample->top[pos].rate = rate;
+	}
+}
+
+/* Writes an IrqSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Prereq: irqs and softirqs are initialized (see initIrqMatrix) from /proc/interrupts and /proc/softirqs.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeIrqDataToPipe(IrqMatrix *irqs, IrqMatrix *softirqs, double delayTime, int writeFD) {
+	IrqSample sample;
+	memset(&sample, 0, sizeof(IrqSample));
+	
+	double start = getTimestamp();
+	sleepFor(delayTime);
+	if (readIrqMatrix(irqs) == -1 || readIrqMatrix(softirqs) == -1) {
+		fprintf(stderr, "error: interrupt counters could not be read\n");
+		return -1;
+	}
+	sample.timestamp = getTimestamp();
+	double interval = sample.timestamp - start;
+	
+	sample.cpus = irqs->cpus;
+	sample.irqRate = computeIrqDeltas(irqs) / interval;
+	sample.softirqRate = computeIrqDeltas(softirqs) / interval;
+	addIrqHotspots(irqs, interval, &sample);
+	addIrqHotspots(softirqs, interval, &sample);
+	
+	// Write sample to pipe
+	if (write(writeFD, &sample, sizeof(IrqSample)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Re-reads the per-cpu run-queue counters of /proc/schedstat into stats, storing the per sec rates
+ * since the previous read (over interval secs) in sample if it is not NULL.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int readSchedStats(SchedStats *stats, double interval, SchedSample *sample) {
+	if (readWholeFile(stats->schedFD, &stats->buf, &stats->bufSize) == -1) return -1;
+	
+	// cpu<n> lines: yld_count, legacy, schedule count, goidle, ttwu, ttwu_local, rq_cpu_time, run_delay, pcount
+	for (char *line = stats->buf; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+		if (*line == '\n') line++;
+		if (strncmp(line, "cpu", 3) != 0 || !isdigit(line[3])) continue;
+		
+		char *tr;
+		long cpu = strtol(line + 3, &tr, 10);
+		if (cpu >= MAXSCHEDCPUS) continue;
+		
+		unsigned long long fields[9];
+		int f = 0;
+		for (; f < 9; f++) {
+			char *end;
+			fields[f] = strtoull(tr, &end, 10);
+			if (end == tr) break;
+			tr = end;
+		}
+		if (f < 9) continue;
+		
+		if (sample != NULL && interval > 0) {
+			unsigned long long wait = (fields[7] >= stats->prevWait[cpu]) ? fields[7] - stats->prevWait[cpu] : 0;
+			unsigned long long slices = (fields[8] >= stats->prevSlices[cpu]) ? fields[8] - stats->prevSlices[cpu] : 0;
+			sample->waitMs[cpu] = wait / 1e6 / interval;
+			sample->slices[cpu] = slices / interval;
+			if (cpu >= sample->cpus) sample->cpus = cpu + 1;
+		}
+		stats->prevWait[cpu] = fields[7];
+		stats->prevSlices[cpu] = fields[8];
+		if (cpu >= stats->cpus) stats->cpus = cpu + 1;
+	}
+	
+	return 0;
+}
+
+/* Opens /proc/schedstat and /proc/loadavg into stats and reads a first baseline.
+ * A missing /proc/schedstat is not an error, samples then only have the load averages.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initSchedStats(SchedStats *stats) {
+	memset(stats, 0, sizeof(SchedStats));
+	stats->loadFD = open("/proc/loadavg", O_RDONLY);
+	if (stats->loadFD == -1) {
+		fprintf(stderr, "error: /proc/loadavg could not be opened\n");
+		return -1;
+	}
+	
+	stats->bufSize = 1 << 16;
+	stats->buf = malloc(stats->bufSize);
+	if (stats->buf == NULL) {
+		fprintf(stderr, "Error allocating memory for file buffer\n");
+		return -1;
+	}
+	
+	// Only there with CONFIG_SCHEDSTATS
+	stats->schedFD = open("/proc/schedstat", O_RDONLY);
+	if (stats->schedFD == -1) {
+		fprintf(stderr, "warn: /proc/schedstat unavailable, run-queue wait not shown\n");
+		return 0;
+	}
+	
+	return readSchedStats(stats, 0, NULL);
+}
+
+/* Frees memory held by (and closes the files of) stats. */
+void freeSchedStats(SchedStats *stats) {
+	if (stats->schedFD != -1) close(stats->schedFD);
+	if (stats->loadFD != -1) close(stats->loadFD);
+	free(stats->buf);
+}
+
+/* Writes a SchedSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeSchedDataToPipe(SchedStats *stats, double delayTime, int writeFD) {
+	SchedSample sample;
+	memset(&sample, 0, sizeof(SchedSample));
+	
+	double start = getTimestamp();
+	sleepFor(delayTime);
+	sample.timestamp = getTimestamp();
+	sample.interval = sample.timestamp - start;
+	
+	if (stats->schedFD != -1 && readSchedStats(stats, sample.interval, &sample) == -1) {
+		fprintf(stderr, "error: /proc/schedstat could not be read\n");
+		return -1;
+	}
+	
+	// "<load1> <load5> <load15> <running>/<total> <last pid>"
+	if (readWholeFile(stats->loadFD, &stats->buf, &stats->bufSize) == -1
+	    || sscanf(stats->buf, "%f %f %f %d/%d", &sample.load[0], &sample.load[1], &sample.load[2], &sample.running, &sample.total) != 5) {
+		fprintf(stderr, "error: /proc/loadavg could not be read\n");
+		return -1;
+	}
+	
+	// Write sample to pipe
+	if (write(writeFD, &sample, sizeof(SchedSample)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Returns the slot addr hashes to in sketch (FNV-1a). */
+int getPeerHome(unsigned char *addr) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < 16; i++) hash = (hash ^ addr[i]) * 16777619u;
+	return hash & (2 * PEERSKETCH - 1);
+}
+
+/* Returns the slot of addr in sketch, or of the empty slot it would be inserted at. */
+int findPeerSlot(PeerSketch *sketch, unsigned char *addr, bool v6) {
+	int slot = getPeerHome(addr);
+	while (sketch->slots[slot] != 0) {
+		PeerCounter *peer = &sketch->heap[sketch->slots[slot] - 1];
+		if (peer->v6 == v6 && memcmp(peer->addr, addr, 16) == 0) break;
+		slot = (slot + 1) & (2 * PEERSKETCH - 1);
+	}
+	return slot;
+}
+
+/* Empties slot of sketch, shifting back later slots of its probe sequence to keep them findable. */
+void removePeerSlot(PeerSketch *sketch, int slot) {
+	int mask = 2 * PEERSKETCH - 1;
+	int hole = slot;
+	sketch->slots[hole] = 0;
+	
+	for (int j = (hole + 1) & mask; sketch->slots[j] != 0; j = (j + 1) & mask) {
+		int home = getPeerHome(sketch->heap[sketch->slots[j] - 1].addr);
+		
+		// Slot can fill the hole if its home isn't cyclically within (hole, j]
+		bool homeBetween = (hole <= j) ? (home > hole && home <= j) : (home > hole || home <= j);
+		if (!homeBetween) {
+			sketch->slots[hole] = sketch->slots[j];
+			sketch->heap[sketch->slots[hole] - 1].slot = hole;
+			sketch->slots[j] = 0;
+			hole = j;
+		}
+	}
+}
+
+/* Swaps heap entries a and b of sketch, keeping their slots pointing at them. */
+void swapPeers(PeerSketch *sketch, int a, int b) {
+	PeerCounter tmp = sketch->heap[a];
+	sketch->heap[a] = sketch->heap[b];
+	sketch->heap[b] = tmp;
+	sketch->slots[sketch->heap[a].slot] = a + 1;
+	sketch->slots[sketch->heap[b].slot] = b + 1;
+}
+
+/* Restores the min-heap order of sketch from idx down, after its count grew. */
+void siftDownPeer(PeerSketch *sketch, int idx) {
+	while (true) {
+		int smallest = idx;
+		for (int child = 2 * idx + 1; child <= 2 * idx + 2 && child < sketch->count; child++) {
+			if (sketch->heap[child].count < sketch->heap[smallest].count) smallest = child;
+		}
+		if (smallest == idx) return;
+		swapPeers(sketch, idx, smallest);
+		idx = smallest;
+	}
+}
+
+/* Counts one socket to addr in sketch. Once full, the least counted peer is replaced,
+ * its count carried over as the newcomer's possible error (Space-Saving).
+ */
+void addPeer(PeerSketch *sketch, unsigned char *addr, bool v6) {
+	int slot = findPeerSlot(sketch, addr, v6);
+	if (sketch->slots[slot] != 0) {
+		int idx = sketch->slots[slot] - 1;
+		sketch->heap[idx].count++;
+		siftDownPeer(sketch, idx);
+		return;
+	}
+	
+	int idx;
+	long error = 0;
+	if (sketch->count < PEERSKETCH) {
+		// New counters start at 1, the minimum, so they can sit at the end once moved up past larger parents
+		idx = sketch->count++;
+		while (idx > 0 && sketch->heap[(idx - 1) / 2].count > 1) {
+			sketch->heap[idx] = sketch->heap[(idx - 1) / 2];
+			sketch->slots[sketch->heap[idx].slot] = idx + 1;
+			idx = (idx - 1) / 2;
+		}
+	}
+	else {
+		idx = 0;
+		error = sketch->heap[0].count;
+		removePeerSlot(sketch, sketch->heap[0].slot);
+		slot = findPeerSlot(sketch, addr, v6);
+	}
+	
+	PeerCounter *peer = &sketch->heap[idx];
+	memcpy(peer->addr, addr, 16);
+	peer->v6 = v6;
+	peer->slot = slot;
+	peer->count = error + 1;
+	peer->error = error;
+	sketch->slots[slot] = idx + 1;
+	siftDownPeer(sketch, idx);
+}
+
+/* Returns the value of the width hex digits at s (/proc/net/tcp fields are fixed width). */
+unsigned int parseHexField(char *s, int width) {
+	unsigned int value = 0;
+	for (int i = 0; i < width; i++) {
+		char c = s[i];
+		value = (value << 4) | ((c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10);
+	}
+	return value;
+}
+
+/* Parses the address of width hex digits at s (32-bit words in host order) into addr. */
+void parseHexAddr(char *s, int width, unsigned char *addr) {
+	memset(addr, 0, 16);
+	for (int w = 0; w < width / 8; w++) {
+		unsigned int word = parseHexField(s + 8 * w, 8);
+		memcpy(addr + 4 * w, &word, 4);
+	}
+}
+
+/* Counts the socket on line (ending at lineEnd) of a socket table into table and sample.
+ * Lines look like "  sl: <local addr>:<port> <remote addr>:<port> <state> ..." (header lines are skipped).
+ */
+void countSocketLine(SocketTable *table, char *line, char *lineEnd, SocketSample *sample) {
+	char *tr = memchr(line, ':', lineEnd - line);
+	if (tr == NULL) return;
+	tr++;
+	while (tr < lineEnd && *tr == ' ') tr++;
+	
+	char *portSep = memchr(tr, ':', lineEnd - tr);
+	if (portSep == NULL) return;
+	int width = portSep - tr;
+	if ((width != 8 && width != 32) || lineEnd - tr < 2 * width + 14) return;
+	
+	char *remote = tr + width + 6;
+	unsigned int state = parseHexField(remote + width + 6, 2);
+	if (state < TCPSTATES) sample->states[state]++;
+	sample->total++;
+	table->ports[parseHexField(portSep + 1, 4)]++;
+	
+	// Listening sockets have no remote peer
+	unsigned char addr[16];
+	parseHexAddr(remote, width, addr);
+	static const unsigned char none[16];
+	if (memcmp(addr, none, 16) != 0) addPeer(&table->peers, addr, width == 32);
+}
+
+/* Streams the socket table at fd through table->buf in SOCKETCHUNK reads, counting each socket into sample.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int scanSocketFile(SocketTable *table, int fd, SocketSample *sample) {
+	size_t carry = 0;	// bytes of a partial line left from the previous chunk
+	off_t offset = 0;
+	
+	while (true) {
+		ssize_t bytes = pread(fd, table->buf + carry, SOCKETCHUNK - carry, offset);
+		if (bytes == -1 && errno == EINTR) continue;
+		if (bytes == -1) {
+			perror("pread");
+			return -1;
+		}
+		if (bytes == 0) break;
+		offset += bytes;
+		
+		char *end = table->buf + carry + bytes;
+		char *line = table->buf;
+		for (char *lineEnd; (lineEnd = memchr(line, '\n', end - line)) != NULL; line = lineEnd + 1) {
+			countSocketLine(table, line, lineEnd, sample);
+		}
+		
+		carry = end - line;
+		if (carry == SOCKETCHUNK) carry = 0;	// no line is this long, drop it
+		memmove(table->buf, line, carry);
+	}
+	
+	return 0;
+}
+
+/* Opens /proc/net/tcp and /proc/net/tcp6 (either may be missing) into table.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initSocketTable(SocketTable *table) {
+	memset(table, 0, sizeof(SocketTable));
+	table->fds[0] = open("/proc/net/tcp", O_RDONLY);
+	table->fds[1] = open("/proc/net/tcp6", O_RDONLY);
+	if (table->fds[0] == -1 && table->fds[1] == -1) {
+		fprintf(stderr, "error: /proc/net/tcp could not be opened\n");
+		return -1;
+	}
+	
+	table->buf = malloc(SOCKETCHUNK);
+	table->ports = malloc(65536 * sizeof(unsigned int));
+	if (table->buf == NULL || table->ports == NULL) {
+		fprintf(stderr, "Error allocating memory for socket tables\n");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Frees memory held by (and closes the files of) table. */
+void freeSocketTable(SocketTable *table) {
+	for (int f = 0; f < 2; f++) {
+		if (table->fds[f] != -1) close(table->fds[f]);
+	}
+	free(table->buf);
+	free(table->ports);
+}
+
+/* Orders PeerCounters by count, most first. */
+int comparePeerCounts(const void *a, const void *b) {
+	long countA = ((PeerCounter *)a)->count, countB = ((PeerCounter *)b)->count;
+	return (countA < countB) - (countA > countB);
+}
+
+/* Waits delayTime seconds, then streams the socket tables and writes a SocketSample of them to the FD given by writeFD.
+ * Never holds more than SOCKETCHUNK bytes of a table, however many sockets there are.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeSocketDataToPipe(SocketTable *table, double delayTime, int writeFD) {
+	SocketSample sample;
+	memset(&sample, 0, sizeof(SocketSample));
+	memset(table->ports, 0, 65536 * sizeof(unsigned int));
+	memset(&table->peers, 0, sizeof(PeerSketch));
+	
+	sleepFor(delayTime);
+	double start = getTimestamp();
+	for (int f = 0; f < 2; f++) {
+		if (table->fds[f] != -1 && scanSocketFile(table, table->fds[f], &sample) == -1) return -1;
+	}
+	sample.timestamp = getTimestamp();
+	sample.scanMs = (sample.timestamp - start) * 1000;
+	
+	// Busiest local ports, kept sorted most sockets first
+	for (int port = 0; port < 65536; port++) {
+		unsigned int count = table->ports[port];
+		if (count == 0 || (sample.portCount == TOPPORTS && count <= sample.ports[TOPPORTS - 1].count)) continue;
+		
+		int pos = (sample.portCount < TOPPORTS) ? sample.portCount++ : TOPPORTS - 1;
+		while (pos > 0 && sample.ports[pos - 1].count < count) {
+			sample.ports[pos] = sample.ports[pos - 1];
+			pos--;
+		}
+		sample.ports[pos].port = port;
+		sample.ports[pos].count = count;
+	}
+	
+	// Heaviest remote peers
+	PeerCounter peers[PEERSKETCH];
+	memcpy(peers, table->peers.heap, table->peers.count * sizeof(PeerCounter));
+	qsort(peers, table->peers.count, sizeof(PeerCounter), comparePeerCounts);
+	sample.peerCount = (table->peers.count < TOPPEERS) ? table->peers.count : TOPPEERS;
+	for (int p = 0; p < sample.peerCount; p++) {
+		inet_ntop(peers[p].v6 ? AF_INET6 : AF_INET, peers[p].addr, sample.peers[p].addr, sizeof(sample.peers[p].addr));
+		sample.peers[p].count = peers[p].count;
+		sample.peers[p].error = peers[p].error;
+	}
+	
+	// Write sample to pipe
+	if (write(writeFD, &sample, sizeof(SocketSample)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+// Counters of /proc/vmstat tracked as rates
+char *vmstatCounterNames[VMSTATRATES] = {"pgmajfault", "pswpin", "pswpout", "allocstall", "compact_stall"};
+// Whether counters named <name>_<zone> are summed into the rate too (allocstall is split per zone since 4.10)
+static bool vmstatCounterPerZone[VMSTATRATES] = {false, false, false, true, false};
+
+/* Opens /proc/vmstat into counters, resolving the line of each tracked counter once.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initVmstatCounters(VmstatCounters *counters) {
+	memset(counters, 0, sizeof(VmstatCounters));
+	counters->fd = open("/proc/vmstat", O_RDONLY);
+	if (counters->fd == -1) {
+		fprintf(stderr, "error: /proc/vmstat could not be opened\n");
+		return -1;
+	}
+	
+	counters->bufSize = 1 << 14;
+	counters->buf = malloc(counters->bufSize);
+	if (counters->buf == NULL || readWholeFile(counters->fd, &counters->buf, &counters->bufSize) == -1) {
+		fprintf(stderr, "error: /proc/vmstat could not be read\n");
+		return -1;
+	}
+	
+	for (char *c = strchr(counters->buf, '\n'); c != NULL; c = strchr(c + 1, '\n')) counters->lines++;
+	counters->lineRate = malloc(counters->lines);
+	if (counters->lineRate == NULL) {
+		fprintf(stderr, "Error allocating memory for vmstat counters\n");
+		return -1;
+	}
+	
+	// "<name> <value>" per line, in an order fixed while the kernel runs
+	bool resolved[VMSTATRATES] = {false};
+	char *line = counters->buf;
+	for (int l = 0; l < counters->lines; l++) {
+		counters->lineRate[l] = -1;
+		for (int r = 0; r < VMSTATRATES; r++) {
+			size_t len = strlen(vmstatCounterNames[r]);
+			if (strncmp(line, vmstatCounterNames[r], len) == 0 && (line[len] == ' ' || (vmstatCounterPerZone[r] && line[len] == '_'))) {
+				counters->lineRate[l] = r;
+				resolved[r] = true;
+				break;
+			}
+		}
+		line = strchr(line, '\n') + 1;
+	}
+	
+	for (int r = 0; r < VMSTATRATES; r++) {
+		if (!resolved[r]) fprintf(stderr, "warn: /proc/vmstat has no %s counter, its rate will show 0\n", vmstatCounterNames[r]);
+	}
+	
+	return 0;
+}
+
+/* Frees memory held by (and closes the file of) counters. */
+void freeVmstatCounters(VmstatCounters *counters) {
+	if (counters->fd != -1) close(counters->fd);
+	free(counters->buf);
+	free(counters->lineRate);
+}
+
+/* Writes VMSTATRATES floats, the per sec rates of the tracked counters since the previous call (0 on the first),
+ * to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeVmstatDataToPipe(VmstatCounters *counters, int writeFD) {
+	if (readWholeFile(counters->fd, &counters->buf, &counters->bufSize) == -1) {
+		fprintf(stderr, "error: /proc/vmstat could not be read\n");
+		return -1;
+	}
+	double now = getTimestamp();
+	
+	// Only the values on the resolved lines are parsed
+	unsigned long long cur[VMSTATRATES] = {0};
+	char *line = counters->buf;
+	for (int l = 0; l < counters->lines && *line != '\0'; l++) {
+		char *lineEnd = strchr(line, '\n');
+		if (counters->lineRate[l] >= 0) {
+			char *value = memchr(line, ' ', (lineEnd == NULL) ? strlen(line) : (size_t)(lineEnd - line));
+			if (value != NULL) cur[(int)counters->lineRate[l]] += strtoull(value + 1, NULL, 10);
+		}
+		if (lineEnd == NULL) break;
+		line = lineEnd + 1;
+	}
+	
+	float rates[VMSTATRATES] = {0};
+	double interval = now - counters->prevTime;
+	for (int r = 0; r < VMSTATRATES; r++) {
+		if (counters->prevTime > 0 && interval > 0 && cur[r] >= counters->prev[r]) rates[r] = (cur[r] - counters->prev[r]) / interval;
+		counters->prev[r] = cur[r];
+	}
+	counters->prevTime = now;
+	
+	// Write rates to pipe
+	if (write(writeFD, rates, sizeof(rates)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Re-reads the numastat file of node n of nodes, storing its numa_hit and numa_miss in hits and misses.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int readNumaStat(NumaNodes *nodes, int n, unsigned long long *hits, unsigned long long *misses) {
+	if (readWholeFile(nodes->numastatFDs[n], &nodes->buf, &nodes->bufSize) == -1) return -1;
+	
+	// "numa_hit <n>" then "numa_miss <n>" lines, among others
+	char *hit = strstr(nodes->buf, "numa_hit ");
+	char *miss = strstr(nodes->buf, "numa_miss ");
+	if (hit == NULL || miss == NULL) return -1;
+	*hits = strtoull(hit + 9, NULL, 10);
+	*misses = strtoull(miss + 10, NULL, 10);
+	return 0;
+}
+
+/* Stores the ids of the NUMA nodes (up to MAXNUMANODES) in ids, in ascending order.
+ * Returns: the number of nodes on success, 
+ *          -1 on error
+ */
+int listNumaNodes(int *ids) {
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (dir == NULL) return -1;
+	
+	int count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL && count < MAXNUMANODES) {
+		int id;
+		char extra;
+		if (sscanf(entry->d_name, "node%d%c", &id, &extra) != 1) continue;
+		
+		int pos = count++;
+		while (pos > 0 && ids[pos - 1] > id) {
+			ids[pos] = ids[pos - 1];
+			pos--;
+		}
+		ids[pos] = id;
+	}
+	closedir(dir);
+	
+	return count;
+}
+
+/* Opens the meminfo and numastat files of every (up to MAXNUMANODES) NUMA node into nodes, and reads a first baseline.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initNumaNodes(NumaNodes *nodes) {
+	memset(nodes, 0, sizeof(NumaNodes));
+	nodes->bufSize = 1 << 12;
+	nodes->buf = malloc(nodes->bufSize);
+	if (nodes->buf == NULL) {
+		fprintf(stderr, "Error allocating memory for file buffer\n");
+		return -1;
+	}
+	
+	nodes->count = listNumaNodes(nodes->ids);
+	if (nodes->count == -1) {
+		fprintf(stderr, "error: /sys/devices/system/node could not be opened (no NUMA support?)\n");
+		return -1;
+	}
+	if (nodes->count == 0) {
+		fprintf(stderr, "error: no NUMA nodes found\n");
+		return -1;
+	}
+	
+	for (int n = 0; n < nodes->count; n++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", nodes->ids[n]);
+		nodes->meminfoFDs[n] = open(path, O_RDONLY);
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", nodes->ids[n]);
+		nodes->numastatFDs[n] = open(path, O_RDONLY);
+		
+		if (nodes->meminfoFDs[n] == -1 || nodes->numastatFDs[n] == -1
+		    || readNumaStat(nodes, n, &nodes->prevHits[n], &nodes->prevMisses[n]) == -1) {
+			fprintf(stderr, "error: memory files of NUMA node %d could not be read\n", nodes->ids[n]);
+			return -1;
+		}
+	}
+	nodes->prevTime = getTimestamp();
+	
+	return 0;
+}
+
+/* Frees memory held by (and closes the files of) nodes. */
+void freeNumaNodes(NumaNodes *nodes) {
+	for (int n = 0; n < nodes->count; n++) {
+		if (nodes->meminfoFDs[n] != -1) close(nodes->meminfoFDs[n]);
+		if (nodes->numastatFDs[n] != -1) close(nodes->numastatFDs[n]);
+	}
+	free(nodes->buf);
+}
+
+/* Writes a NumaSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeNumaDataToPipe(NumaNodes *nodes, double delayTime, int writeFD) {
+	NumaSample sample;
+	memset(&sample, 0, sizeof(NumaSample));
+	
+	sleepFor(delayTime);
+	sample.timestamp = getTimestamp();
+	double interval = sample.timestamp - nodes->prevTime;
+	nodes->prevTime = sample.timestamp;
+	sample.count = nodes->count;
+	
+	for (int n = 0; n < nodes->count; n++) {
+		NumaNodeSample *node = &sample.nodes[n];
+		node->id = nodes->ids[n];
+		
+		unsigned long long hits, misses;
+		if (readNumaStat(nodes, n, &hits, &misses) == -1) {
+			fprintf(stderr, "error: numastat of NUMA node %d could not be read\n", node->id);
+			return -1;
+		}
+		if (interval > 0) {
+			node->hitRate = (hits >= nodes->prevHits[n]) ? (hits - nodes->prevHits[n]) / interval : 0;
+			node->missRate = (misses >= nodes->prevMisses[n]) ? (misses - nodes->prevMisses[n]) / interval : 0;
+		}
+		nodes->prevHits[n] = hits;
+		nodes->prevMisses[n] = misses;
+		
+		// "Node <id> <key>: <value> [kB]" lines
+		if (readWholeFile(nodes->meminfoFDs[n], &nodes->buf, &nodes->bufSize) == -1) {
+			fprintf(stderr, "error: meminfo of NUMA node %d could not be read\n", node->id);
+			return -1;
+		}
+		for (char *line = nodes->buf; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+			if (*line == '\n') line++;
+			char *key = strchr(line, ' ');
+			if (key == NULL || (key = strchr(key + 1, ' ')) == NULL) break;
+			key++;
+			
+			char *colon = strchr(key, ':');
+			if (colon == NULL) break;
+			unsigned long long value = strtoull(colon + 1, NULL, 10);
+			float gb = value * 1024.0 / GiB;
+			
+			int keyLen = colon - key;
+			if (keyLen == 8 && strncmp(key, "MemTotal", 8) == 0) node->memTotal = gb;
+			else if (keyLen == 7 && strncmp(key, "MemFree", 7) == 0) node->memFree = gb;
+			else if (keyLen == 9 && strncmp(key, "FilePages", 9) == 0) node->filePages = gb;
+			else if (keyLen == 9 && strncmp(key, "AnonPages", 9) == 0) node->anonPages = gb;
+			else if (keyLen == 15 && strncmp(key, "HugePages_Total", 15) == 0) node->hugeTotal = value;
+			else if (keyLen == 14 && strncmp(key, "HugePages_Free", 14) == 0) node->hugeFree = value;
+		}
+	}
+	
+	// Write sample to pipe
+	if (write(writeFD, &sample, sizeof(NumaSample)) == -1) {
+		perror("write");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Appends a line "<timestamp> <metric> <values...>" recording a sample to the FD given by recordFD
+ * (see merge_recordings.h), in a single write so collectors can share the file.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeRecordLine(int recordFD, double timestamp, char *metric, float *values, int count) {
+	char line[256];
+	int len = snprintf(line, sizeof(line), "%.3f %s", timestamp, metric);
+	for (int v = 0; v < count && len < sizeof(line); v++) len += snprintf(line + len, sizeof(line) - len, " %.4f", values[v]);
+	if (len >= sizeof(line) - 1) len = sizeof(line) - 2;
+	line[len++] = '\n';
+	
+	if (write(recordFD, line, len) == -1) {
+		perror("write");
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns the memory (GiB) available for new allocations without swapping (MemAvailable of /proc/meminfo),
+ * which unlike free memory counts reclaimable page cache, or -1 on error.
+ */
+float getMemAvailable() {
+	FILE *meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo == NULL) return -1;
+	
+	char line[256];
+	float available = -1;
+	unsigned long long kb;
+	while (fgets(line, sizeof(line), meminfo) != NULL) {
+		if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+			available = kb * 1024.0 / GiB;
+			break;
+		}
+	}
+	
+	fclose(meminfo);
+	return available;
+}
+
+/* Writes 4 memory statistics (system-wide) and the time they were sampled at to the FD given by writeFD.
+ * Writes in the order: double timestamp, float physUsed, float physTot, float virtUsed, float virtTot (all in GiB)
+ * If sample is not NULL, the 4 statistics are also copied to it (in the same order).
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeMemoryDataToPipe(int writeFD) {
+int writeMemoryDataToPipe(int writeFD, float *sample) {
 	// Get memory usage
 	struct sysinfo systemInfo;
 	float physTot, physUsed, virtTot, virtUsed;
@@ -32,6 +1718,15 @@ int writeMemoryDataToPipe(int writeFD) {
 	virtUsed = ((float)systemInfo.totalswap / (float)GiB) - ((float)systemInfo.freeswap / (float)GiB) + physUsed;
 
 	float memData[4] = {physUsed, physTot, virtUsed, virtTot};
+	double timestamp = getTimestamp();
+	
+	if (sample != NULL) memcpy(sample, memData, sizeof(memData));
+	
+	// Write timestamp to pipe
+	if (write(writeFD, &timestamp, sizeof(double)) == -1) {
+		perror("write");
+		return -1;
+	}
 
 	// Write physUsed, physTot, virtUsed, virtTot to pipe
 	for (int k = 0; k < 4; k++) {
@@ -45,16 +1740,21 @@ int writeMemoryDataToPipe(int writeFD) {
 }
 
 /* Writes user details as a string of MAXSIZE to the FD given by writeFD, terminated by the empty string.
- * Prereq: usersFile is a valid file w/ pointer at BoF.
+ * If usage is not NULL, each session is joined with the totals of its user (and processes on its tty),
+ * followed by the TOPUSERS users using the most cpu.
+ * If sessions is not NULL, it is set to the number of user sessions written.
+ * Prereq: usersFile is a valid file w/ pointer at BoF, or NULL if sessions are unavailable.
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeUserDataToPipe(FILE *usersFile, int writeFD) {
+int writeUserDataToPipe(FILE *usersFile, int writeFD, int *sessions, UserUsageTable *usage) {
 	struct utmp userInfo;
 	char userString[MAXSIZE] = {0};	// initialize to 0
+	int sessionCount = 0;
+	float gbPerPage = (float)sysconf(_SC_PAGESIZE) / (float)GiB;
 	
 	// Parse through list of users and print logged in users
-	while (fread(&userInfo, sizeof(struct utmp), 1, usersFile) == 1) {
+	while (usersFile != NULL && fread(&userInfo, sizeof(struct utmp), 1, usersFile) == 1) {
 		if (userInfo.ut_type != USER_PROCESS) continue;
 		
 		char userDetails[UT_HOSTSIZE];
@@ -89,11 +1789,73 @@ int writeUserDataToPipe(FILE *usersFile, int writeFD) {
 		// Formulate full string for user details
 		sprintf(userString, "%s\t%s (%s)", userInfo.ut_user, userInfo.ut_line, userDetails);
 		
+		// Join with the totals of the session's user
+		if (usage != NULL) {
+			char name[UT_NAMESIZE + 1], ttyPath[UT_LINESIZE + 6];
+			strncpy(name, userInfo.ut_user, UT_NAMESIZE);
+			name[UT_NAMESIZE] = '\0';
+			snprintf(ttyPath, sizeof(ttyPath), "/dev/%.*s", UT_LINESIZE, userInfo.ut_line);
+			
+			struct passwd *pw = getpwnam(name);
+			UserSlot *slot = NULL;
+			for (int u = 0; pw != NULL && u < usage->slotCount; u++) {
+				if (usage->slots[u].uid == pw->pw_uid) slot = &usage->slots[u];
+			}
+			
+			int ttyProcs = 0;
+			struct stat ttyInfo;
+			if (stat(ttyPath, &ttyInfo) == 0) {
+				for (int t = 0; t < usage->ttyCount; t++) {
+					if (usage->ttys[t] == ttyInfo.st_rdev) ttyProcs = usage->ttyProcs[t];
+				}
+			}
+			
+			if (slot != NULL) {
+				int len = strlen(userString);
+				snprintf(userString + len, MAXSIZE - len, "  -- cpu %.2f%%, rss %.2f GB, %d procs / %d threads (%d on tty)",
+				         getUserCpuUse(usage, slot), slot->rssPages * gbPerPage, slot->procs, slot->threads, ttyProcs);
+			}
+		}
+		
 		// Write userString to pipe
 		if (write(writeFD, userString, MAXSIZE) == -1) {
 			perror("write");
 			return -1;
 		}
+		sessionCount++;
+	}
+	
+	if (sessions != NULL) *sessions = sessionCount;
+	
+	// Write users with the highest cpu use (selection over the few user slots)
+	if (usage != NULL) {
+		bool shown[MAXUSERSLOTS] = {false};
+		for (int n = 0; n < TOPUSERS; n++) {
+			int top = -1;
+			for (int u = 0; u < usage->slotCount; u++) {
+				if (shown[u] || usage->slots[u].procs <= 0) continue;
+				if (top == -1 || usage->slots[u].cpuTicks > usage->slots[top].cpuTicks) top = u;
+			}
+			if (top == -1) break;
+			shown[top] = true;
+			
+			if (n == 0) {
+				memset(userString, 0, MAXSIZE);
+				sprintf(userString, "Top users (cpu, rss, procs / threads):");
+				if (write(writeFD, userString, MAXSIZE) == -1) {
+					perror("write");
+					return -1;
+				}
+			}
+			
+			UserSlot *slot = &usage->slots[top];
+			memset(userString, 0, MAXSIZE);
+			sprintf(userString, " %-12s %6.2f%%  %6.2f GB  %4d / %-5d", slot->name, getUserCpuUse(usage, slot), slot->rssPages * gbPerPage, slot->procs, slot->threads);
+			if (write(writeFD, userString, MAXSIZE) == -1) {
+				perror("write");
+				return -1;
+			}
+		}
 	}
 	
 	// Write empty string to pipe to signal termination
@@ -105,13 +1867,14 @@ int writeUserDataToPipe(FILE *usersFile, int writeFD) {
 	return 0;
 }
 
-/* Writes 2 CPU statistics to the FD given by writeFD.
- * Writes in the order: int cores, float cpuUsage (%)
+/* Writes 2 CPU statistics, sampled over delayTime seconds, to the FD given by writeFD.
+ * Writes in the order: int cores, float cpuUsage (%), double timestamp (end of the sample)
+ * If usage is not NULL, it is set to cpuUsage.
  * Prereq: cpuInfo and stats are valid files w/ pointers at BoF.
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeCPUDataToPipe(FILE *cpuInfo, unsigned int delayTime, int writeFD) {
+int writeCPUDataToPipe(FILE *cpuInfo, double delayTime, int writeFD, float *usage) {
 	int cores;
 	long initialTotTime, newTotTime, initialTimeIdle, newTimeIdle;
 	long userT = 0, niceT = 0, systemT = 0, idleT = 0, iowaitT = 0, irqT = 0, softirqT = 0;
@@ -151,7 +1914,7 @@ int writeCPUDataToPipe(FILE *cpuInfo, unsigned int delayTime, int writeFD) {
 	initialTotTime = userT + niceT + systemT + idleT + iowaitT + irqT + softirqT;
 	
 	// Sleep for provided amount of time (differs between iterations)
-	sleep(delayTime);
+	sleepFor(delayTime);
 	
 	if (fscanf(stats, "%*s %ld %ld %ld %ld %ld %ld %ld", &userT, &niceT, &systemT, &idleT, &iowaitT, &irqT, &softirqT) != 7) {
 		fprintf(stderr, "warn: Some fields are missing when getting cpu stats\n");
@@ -162,12 +1925,16 @@ int writeCPUDataToPipe(FILE *cpuInfo, unsigned int delayTime, int writeFD) {
 	newTimeIdle = idleT;
 	newTotTime = userT + niceT + systemT + idleT + iowaitT + irqT + softirqT;
 	
-	if (newTimeIdle - initialTimeIdle == 0 || newTotTime - initialTotTime == 0) {
+	// No idle time passing means the CPU was fully busy, only an empty interval has no usage
+	if (newTotTime - initialTotTime == 0) {
 		cpuUsage = 0;
 	}
 	else cpuUsage = 100 * (double)((newTotTime - newTimeIdle) - (initialTotTime - initialTimeIdle)) / (double)(newTotTime - initialTotTime);
 	
-	// Write cores and cpuUsage to pipe
+	double timestamp = getTimestamp();
+	if (usage != NULL) *usage = cpuUsage;
+	
+	// Write cores, cpuUsage and timestamp to pipe
 	if (write(writeFD, &cores, sizeof(int)) == -1) {
 		perror("write");
 		return -1;
@@ -176,6 +1943,10 @@ int writeCPUDataToPipe(FILE *cpuInfo, unsigned int delayTime, int writeFD) {
 		perror("write");
 		return -1;
 	}
+	if (write(writeFD, &timestamp, sizeof(double)) == -1) {
+		perror("write");
+		return -1;
+	}
 	
 	// Close stats file
 	if (fclose(stats) != 0) {
@@ -1,32 +1,494 @@
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdbool.h>
+#include<sys/types.h>
 
 #define MAXSIZE 4096
 #define GiB 1073741824
+#define MAXALERTS 32
+#define MAXUSERSLOTS 256
+#define TOPUSERS 5
+#define TOPIRQS 10
+#define MAXSCHEDCPUS 256	// cpus beyond this are left out of the scheduler statistics
+#define TCPSTATES 13		// TCP_ESTABLISHED (1) .. TCP_NEW_SYN_RECV (12), 0 unused
+#define TOPPORTS 10
+#define TOPPEERS 10
+#define PEERSKETCH 64		// remote peers tracked by the heavy-hitter sketch
+#define SOCKETCHUNK (1 << 20)	// bytes of a socket table read at once
+#define MAXNUMANODES 64
+#define VMSTATRATES 5		// paging/reclaim counters of /proc/vmstat tracked (see vmstatCounterNames)
+#define SHORTLIVED 1.0	// secs, processes exiting sooner than this after forking are counted as short-lived
 
 #ifndef __Graph_Algos_header
 #define __Graph_Algos_header
 
-/* Writes 4 memory statistics (system-wide) to the FD given by writeFD.
- * Writes in the order: float physUsed, float physTot, float virtUsed, float virtTot (all in GiB)
+// State for a collector sampling at an adaptive rate
+typedef struct AdaptiveDelay {
+	double minDelay;	// secs, fastest allowed interval
+	double maxDelay;	// secs, floor rate the interval relaxes back to
+	float threshold;	// change between consecutive samples that tightens the interval
+	double curDelay;	// secs, interval to wait before the next sample
+	float lastValue;
+	bool hasLast;
+} AdaptiveDelay;
+
+/* Initializes ad to sample every maxDelay seconds until a change of at least threshold is seen.
+ * Prereq: 0 < minDelay <= maxDelay
+ */
+void initAdaptiveDelay(AdaptiveDelay *ad, double minDelay, double maxDelay, float threshold);
+
+/* Feeds the latest sample value into ad and returns the delay (secs) before the next sample.
+ * Halves the delay when the value moved by at least ad->threshold since the last sample,
+ * otherwise grows it by 25%, always staying within [minDelay, maxDelay].
+ */
+double nextAdaptiveDelay(AdaptiveDelay *ad, float value);
+
+/* Returns the current wall-clock time in seconds since the epoch. */
+double getTimestamp();
+
+/* Sleeps for the given (possibly fractional) amount of seconds, resuming after signals. */
+void sleepFor(double seconds);
+
+// Metrics that alert rules can be written against
+typedef enum AlertMetric {
+	ALERT_CPU,			// cpu: total cpu use (%)
+	ALERT_MEM_USED,		// mem.used: physical memory used, total - free as in the memory section, so page cache counts (GiB)
+	ALERT_MEM_AVAIL,	// mem.avail: physical memory available without swapping, MemAvailable (GiB)
+	ALERT_MEM_PCT,		// mem.pct: mem.used as a % of total (page cache counts, see mem.avail for memory really short)
+	ALERT_VIRT_USED,	// virt.used: virtual memory used (GiB)
+	ALERT_USERS			// users: number of user sessions
+} AlertMetric;
+
+// Threshold rule compiled from a string such as "cpu>90 for 5s" or "mem.avail<2GiB clear 3GiB"
+typedef struct AlertRule {
+	AlertMetric metric;
+	bool above;			// fires when value goes above level (else below)
+	bool inclusive;		// >= / <= rather than > / <
+	float level;
+	float clearLevel;	// value must get back past this level to clear (hysteresis)
+	double holdTime;	// secs the condition must hold before firing (debounce)
+	double pendingSince;	// time the condition started holding, <0 if not holding
+	bool firing;
+	char text[64];		// rule as given by the user
+} AlertRule;
+
+// Flat set of alert rules, checked by each collector as it samples
+typedef struct AlertSet {
+	AlertRule rules[MAXALERTS];
+	int count;
+	unsigned int metrics;	// bit (1 << AlertMetric) set for each metric some rule is written against
+	char *hook;		// shell command run when a rule fires or clears, NULL if none
+	int logFD;		// FD event records are appended to, -1 if none
+} AlertSet;
+
+/* Compiles the rule in text and appends it to set.
+ * Format: <metric><op><value>[unit] [for <duration>] [clear <value>[unit]]
+ *         op is one of >, >=, <, <=; unit is one of %, KiB, MiB, GiB; duration is given in ms, s or m.
+ * Without a clear value, the rule clears once the value is 5% back past its level.
+ * A firing rule clears once its condition no longer holds and the value has reached the clear value (inclusive).
+ * Returns: 0 on success, 
+ *          -1 on error (invalid rule or set is full)
+ */
+int compileAlertRule(AlertSet *set, char *text);
+
+/* Checks a new sample of metric against every rule in set, reporting rules that fire or clear.
+ * A fired/cleared rule runs set->hook (with ALERT_STATE, ALERT_RULE, ALERT_VALUE and ALERT_TIME in its
+ * environment) and appends an event record to set->logFD; if neither is set the record goes to stderr.
+ */
+void checkAlerts(AlertSet *set, AlertMetric metric, float value, double timestamp);
+
+// Open-addressed hash table of per-process entries keyed by pid (the first member of each entry, 0 if empty)
+typedef struct PidTable {
+	void *entries;
+	size_t entrySize;
+	int capacity;	// power of 2
+	int count;
+} PidTable;
+
+/* Initializes an empty table of entries of entrySize bytes, each starting with a pid_t.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initPidTable(PidTable *table, size_t entrySize);
+
+/* Returns the entry at idx of table. */
+void *getPidEntry(PidTable *table, int idx);
+
+/* Returns the index of pid's entry in table, or of the empty entry it would be inserted at. */
+int findPidEntry(PidTable *table, pid_t pid);
+
+/* Empties the entry at idx, shifting back later entries of its probe sequence to keep them findable. */
+void removePidEntry(PidTable *table, int idx);
+
+/* Makes room for one more entry in table, doubling its capacity once it is half full.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int reservePidEntry(PidTable *table);
+
+/* Frees memory held by table. */
+void freePidTable(PidTable *table);
+
+// Last seen usage of one process
+typedef struct PidUsage {
+	pid_t pid;			// 0 if entry is empty
+	int slot;			// index of the owner's UserSlot
+	unsigned long long startTime;	// clock ticks after boot, tells a reused pid apart
+	unsigned long cpuTicks;	// utime + stime
+	long rssPages;
+	int threads;
+	unsigned int seen;	// scan the process was last seen in
+} PidUsage;
+
+// Totals over every process of one uid
+typedef struct UserSlot {
+	uid_t uid;
+	char name[32];
+	unsigned long cpuTicks;	// cpu ticks used since the previous scan
+	long rssPages;
+	int procs;
+	int threads;
+} UserSlot;
+
+// Per-user resource usage, updated incrementally from per-pid deltas on each scan of /proc
+typedef struct UserUsageTable {
+	PidTable pids;		// of PidUsage
+	UserSlot slots[MAXUSERSLOTS];
+	int slotCount;
+	unsigned int scans;
+	double lastScan;	// secs since epoch
+	double interval;	// secs between the last two scans
+	dev_t ttys[MAXUSERSLOTS];	// ttys processes are attached to ...
+	int ttyProcs[MAXUSERSLOTS];	// ... and how many are attached to each (rebuilt each scan)
+	int ttyCount;
+} UserUsageTable;
+
+/* Initializes an empty table.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initUserUsage(UserUsageTable *table);
+
+/* Scans every /proc/[pid]/status and stat once, applying the change in each process' cpu time, RSS and threads
+ * (and processes that started or exited) to the totals of its real uid.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int updateUserUsage(UserUsageTable *table);
+
+/* Frees memory held by table. */
+void freeUserUsage(UserUsageTable *table);
+
+// Process known to be alive, tracked from fork/exit events (or /proc rescans when polling)
+typedef struct LiveProc {
+	pid_t pid;			// 0 if entry is empty
+	double forkTime;	// secs since boot, <0 if the process was already running at startup
+	unsigned int seen;	// rescan the process was last seen in (polling only)
+} LiveProc;
+
+// Process lifecycle activity over one sample
+typedef struct ProcEventSample {
+	double timestamp;	// secs since epoch
+	double interval;	// secs the sample was taken over
+	int forks;			// new processes
+	int threads;		// new threads
+	int execs;
+	int exits;
+	int shortLived;		// processes that exited less than SHORTLIVED secs after forking
+	int live;			// processes alive at the end of the sample
+	bool polled;		// taken by rescanning /proc, so execs and short-lived processes were not seen
+} ProcEventSample;
+
+/* Subscribes to fork/exec/exit events from the kernel's netlink proc connector.
+ * Returns: socket FD to receive events from on success, 
+ *          -1 on error (e.g. connector unavailable or not privileged)
+ */
+int openProcConnector();
+
+/* Initializes live (a PidTable of LiveProc) with every process currently in /proc.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initLiveProcs(PidTable *live);
+
+/* Writes a ProcEventSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Events are read from connFD (see openProcConnector), or if connFD is -1, /proc is rescanned after
+ * delayTime seconds and new/missing pids are counted as forks/exits.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeProcEventDataToPipe(int connFD, PidTable *live, double delayTime, int writeFD);
+
+// Per-row x per-cpu counters of /proc/interrupts or /proc/softirqs (same layout), re-read in place each sample
+typedef struct IrqMatrix {
+	int fd;				// kept open, re-read from offset 0
+	char *buf;			// reusable buffer holding the whole file
+	size_t bufSize;
+	int cpus;			// columns, from the header line
+	int rows;
+	int rowCapacity;
+	char (*labels)[16];	// row label before ':' (e.g. "24", "LOC", "NET_RX")
+	char (*names)[32];	// label + device/description, for display
+	unsigned long long *counts;	// rows x cpus, row-major
+	unsigned long long *prev;	// counts of the previous read
+	unsigned long long *deltas;	// counts - prev
+} IrqMatrix;
+
+// Hottest IRQ/cpu pair over one sample
+typedef struct IrqHotspot {
+	char name[32];
+	int cpu;
+	float rate;		// per sec
+} IrqHotspot;
+
+// Interrupt activity over one sample
+typedef struct IrqSample {
+	double timestamp;	// secs since epoch
+	int cpus;
+	float irqRate;		// per sec, over all IRQs and cpus
+	float softirqRate;	// per sec, over all softirqs and cpus
+	int count;			// hotspots in top
+	IrqHotspot top[TOPIRQS];	// hardware and soft, hottest first
+} IrqSample;
+
+/* Opens the interrupt counters file at path and reads a first baseline into matrix.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initIrqMatrix(IrqMatrix *matrix, char *path);
+
+/* Frees memory held by (and closes the file of) matrix. */
+void freeIrqMatrix(IrqMatrix *matrix);
+
+/* Writes an IrqSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Prereq: irqs and softirqs are initialized (see initIrqMatrix) from /proc/interrupts and /proc/softirqs.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeIrqDataToPipe(IrqMatrix *irqs, IrqMatrix *softirqs, double delayTime, int writeFD);
+
+// Scheduler statistics files, kept open and re-read each sample
+typedef struct SchedStats {
+	int schedFD;		// /proc/schedstat, -1 if the kernel has no scheduler statistics
+	int loadFD;			// /proc/loadavg
+	char *buf;			// reusable buffer holding the whole file
+	size_t bufSize;
+	int cpus;
+	unsigned long long prevWait[MAXSCHEDCPUS];		// ns runnable tasks waited on each cpu's run queue
+	unsigned long long prevSlices[MAXSCHEDCPUS];	// timeslices run on each cpu
+} SchedStats;
+
+// Scheduler load over one sample
+typedef struct SchedSample {
+	double timestamp;	// secs since epoch
+	double interval;	// secs the sample was taken over
+	float load[3];		// 1, 5 and 15 minute load averages
+	int running;		// runnable tasks
+	int total;			// tasks in the system
+	int cpus;			// 0 if per-cpu statistics are unavailable
+	float waitMs[MAXSCHEDCPUS];		// ms per sec runnable tasks waited on each cpu's run queue
+	float slices[MAXSCHEDCPUS];		// timeslices per sec run on each cpu
+} SchedSample;
+
+/* Opens /proc/schedstat and /proc/loadavg into stats and reads a first baseline.
+ * A missing /proc/schedstat is not an error, samples then only have the load averages.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initSchedStats(SchedStats *stats);
+
+/* Frees memory held by (and closes the files of) stats. */
+void freeSchedStats(SchedStats *stats);
+
+/* Writes a SchedSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeSchedDataToPipe(SchedStats *stats, double delayTime, int writeFD);
+
+// Remote peer counted by a PeerSketch
+typedef struct PeerCounter {
+	unsigned char addr[16];	// network byte order, IPv4 in the first 4 bytes
+	bool v6;
+	int slot;				// index of the peer in the sketch's slots
+	long count;				// sockets to the peer, overestimated by at most error
+	long error;
+} PeerCounter;
+
+// Space-Saving sketch of the remote peers with the most sockets, in fixed memory
+typedef struct PeerSketch {
+	PeerCounter heap[PEERSKETCH];	// min-heap on count
+	int count;
+	int slots[2 * PEERSKETCH];		// open addressed by address, heap index + 1 of the peer (0 if empty)
+} PeerSketch;
+
+// Socket tables, kept open and streamed through a reusable buffer each sample
+typedef struct SocketTable {
+	int fds[2];				// /proc/net/tcp and /proc/net/tcp6, -1 if missing
+	char *buf;				// SOCKETCHUNK bytes
+	unsigned int *ports;	// sockets per local port (65536)
+	PeerSketch peers;
+} SocketTable;
+
+typedef struct PortCount {
+	unsigned short port;
+	unsigned int count;
+} PortCount;
+
+typedef struct PeerCount {
+	char addr[46];			// printable address
+	long count;				// overestimated by at most error
+	long error;
+} PeerCount;
+
+// Snapshot of the socket tables
+typedef struct SocketSample {
+	double timestamp;		// secs since epoch
+	float scanMs;			// time taken to stream the tables
+	long total;
+	long states[TCPSTATES];	// sockets per TCP state
+	int portCount;
+	PortCount ports[TOPPORTS];	// busiest local ports, most sockets first
+	int peerCount;
+	PeerCount peers[TOPPEERS];	// remote peers with most sockets first
+} SocketSample;
+
+/* Opens /proc/net/tcp and /proc/net/tcp6 (either may be missing) into table.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initSocketTable(SocketTable *table);
+
+/* Frees memory held by (and closes the files of) table. */
+void freeSocketTable(SocketTable *table);
+
+/* Waits delayTime seconds, then streams the socket tables and writes a SocketSample of them to the FD given by writeFD.
+ * Never holds more than SOCKETCHUNK bytes of a table, however many sockets there are.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeSocketDataToPipe(SocketTable *table, double delayTime, int writeFD);
+
+// Counters of /proc/vmstat tracked as rates: pgmajfault, pswpin, pswpout, allocstall (direct reclaim), compact_stall
+extern char *vmstatCounterNames[VMSTATRATES];
+
+// /proc/vmstat, kept open and parsed by line position each sample
+typedef struct VmstatCounters {
+	int fd;
+	char *buf;				// reusable buffer holding the whole file
+	size_t bufSize;
+	int lines;
+	signed char *lineRate;	// per line, index of the rate its counter adds to (-1 if untracked)
+	unsigned long long prev[VMSTATRATES];
+	double prevTime;		// secs since epoch of the previous read, 0 before the first
+} VmstatCounters;
+
+/* Opens /proc/vmstat into counters, resolving the line of each tracked counter once.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initVmstatCounters(VmstatCounters *counters);
+
+/* Frees memory held by (and closes the file of) counters. */
+void freeVmstatCounters(VmstatCounters *counters);
+
+/* Writes VMSTATRATES floats, the per sec rates of the tracked counters since the previous call (0 on the first),
+ * to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeVmstatDataToPipe(VmstatCounters *counters, int writeFD);
+
+// Per-node memory files under /sys/devices/system/node, kept open and re-read each sample
+typedef struct NumaNodes {
+	int count;
+	int ids[MAXNUMANODES];
+	int meminfoFDs[MAXNUMANODES];
+	int numastatFDs[MAXNUMANODES];
+	char *buf;				// reusable buffer holding a whole file
+	size_t bufSize;
+	unsigned long long prevHits[MAXNUMANODES];	// numa_hit of the previous read
+	unsigned long long prevMisses[MAXNUMANODES];	// numa_miss of the previous read
+	double prevTime;		// secs since epoch of the previous read
+} NumaNodes;
+
+// Memory of one NUMA node over one sample
+typedef struct NumaNodeSample {
+	int id;
+	float memTotal;			// GB
+	float memFree;			// GB
+	float filePages;		// GB
+	float anonPages;		// GB
+	int hugeTotal;			// huge pages
+	int hugeFree;			// huge pages
+	float hitRate;			// per sec, pages allocated on this node as intended
+	float missRate;			// per sec, pages allocated on this node though intended for another
+} NumaNodeSample;
+
+typedef struct NumaSample {
+	double timestamp;		// secs since epoch
+	int count;
+	NumaNodeSample nodes[MAXNUMANODES];
+} NumaSample;
+
+/* Stores the ids of the NUMA nodes (up to MAXNUMANODES) in ids, in ascending order.
+ * Returns: the number of nodes on success, 
+ *          -1 on error
+ */
+int listNumaNodes(int *ids);
+
+/* Opens the meminfo and numastat files of every (up to MAXNUMANODES) NUMA node into nodes, and reads a first baseline.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int initNumaNodes(NumaNodes *nodes);
+
+/* Frees memory held by (and closes the files of) nodes. */
+void freeNumaNodes(NumaNodes *nodes);
+
+/* Writes a NumaSample, taken over delayTime seconds, to the FD given by writeFD.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeNumaDataToPipe(NumaNodes *nodes, double delayTime, int writeFD);
+
+/* Appends a line "<timestamp> <metric> <values...>" recording a sample to the FD given by recordFD
+ * (see merge_recordings.h), in a single write so collectors can share the file.
+ * Returns: 0 on success, 
+ *          -1 on error
+ */
+int writeRecordLine(int recordFD, double timestamp, char *metric, float *values, int count);
+
+/* Returns the memory (GiB) available for new allocations without swapping (MemAvailable of /proc/meminfo),
+ * which unlike free memory counts reclaimable page cache, or -1 on error.
+ */
+float getMemAvailable();
+
+/* Writes 4 memory statistics (system-wide) and the time they were sampled at to the FD given by writeFD.
+ * Writes in the order: double timestamp, float physUsed, float physTot, float virtUsed, float virtTot (all in GiB)
+ * If sample is not NULL, the 4 statistics are also copied to it (in the same order).
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeMemoryDataToPipe(int writeFD);
+int writeMemoryDataToPipe(int writeFD, float *sample);
 
 /* Writes user details as a string of MAXSIZE to the FD given by writeFD, terminated by the empty string.
- * Prereq: usersFile is a valid file w/ pointer at BoF.
+ * If usage is not NULL, each session is joined with the totals of its user (and processes on its tty),
+ * followed by the TOPUSERS users using the most cpu.
+ * If sessions is not NULL, it is set to the number of user sessions written.
+ * Prereq: usersFile is a valid file w/ pointer at BoF, or NULL if sessions are unavailable.
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeUserDataToPipe(FILE *usersFile, int writeFD);
+int writeUserDataToPipe(FILE *usersFile, int writeFD, int *sessions, UserUsageTable *usage);
 
-/* Writes 2 CPU statistics to the FD given by writeFD.
- * Writes in the order: int cores, float cpuUsage (%)
+/* Writes 2 CPU statistics, sampled over delayTime seconds, to the FD given by writeFD.
+ * Writes in the order: int cores, float cpuUsage (%), double timestamp (end of the sample)
+ * If usage is not NULL, it is set to cpuUsage.
  * Prereq: cpuInfo and stats are valid files w/ pointers at BoF.
  * Returns: 0 on success, 
  *          -1 on error
  */
-int writeCPUDataToPipe(FILE *cpuInfo, unsigned int delayTime, int writeFD);
+int writeCPUDataToPipe(FILE *cpuInfo, double delayTime, int writeFD, float *usage);
 
 #endif
@@ -11,8 +11,33 @@
 #include<unistd.h>
 #include<signal.h>
 #include<sys/wait.h>
+#include<fcntl.h>
+#include<sys/ioctl.h>
 
 #include "stats_functions.h"
+#include "merge_recordings.h"
+
+#define ROLLUPTIERS 5	// raw, 10s, 1m, 10m, 1h
+#define ROLLUPWIDTH 60	// buckets kept per rollup tier
+#define FIRSTCPUSAMPLE 0.05	// secs the first cpu usage sample is taken over
+#define NUMAIMBALANCE 25	// spread of node used% (points) flagged as imbalanced
+
+// Names of the TCP states in /proc/net/tcp, by state number
+static char *tcpStateNames[TCPSTATES] = {"?", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2", "TIME_WAIT",
+                                         "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"};
+
+// Collector children, each writing its samples to its own pipe
+enum ChildRole {
+	MEMORY_CHILD,
+	USERS_CHILD,
+	CPU_CHILD,
+	PROC_EVENTS_CHILD,	// only with --proc-events
+	IRQ_CHILD,			// only with --irq
+	SCHED_CHILD,		// only with --sched
+	SOCKETS_CHILD,		// only with --sockets
+	NUMA_CHILD,			// only with --numa
+	CHILD_ROLES
+};
 
 /*
  * Function: extractFlagValue
@@ -89,20 +114,25 @@ void formatToTwoDigits(int num, char *strAddress) {
 
 // Struct for storing samples of memory data in linked list
 typedef struct MemoryNode {
+	double timestamp;	// secs since epoch
 	float physUsed;	// GB
 	float physTot;	// GB
 	float virtUsed;	// GB
 	float virtTot;	// GB
+	bool hasVmstat;
+	float vmRates[VMSTATRATES];	// per sec paging/reclaim activity (see vmstatCounterNames), if hasVmstat
 	struct MemoryNode *next;
 } MemoryNode;
 // Linked list operations
-MemoryNode *newMNode(float physUsed, float physTot, float virtUsed, float virtTot) {
+MemoryNode *newMNode(double timestamp, float physUsed, float physTot, float virtUsed, float virtTot) {
 	MemoryNode *new = malloc(1 * sizeof(MemoryNode));
 	if (new == NULL) fprintf(stderr, "Error allocating memory for MemoryNode\n.");
+	new->timestamp = timestamp;
 	new->physUsed = physUsed;
 	new->physTot = physTot;
 	new->virtUsed = virtUsed;
 	new->virtTot = virtTot;
+	new->hasVmstat = false;
 	new->next = NULL;
 	return new;
 }
@@ -111,7 +141,7 @@ void insertMAtTail(MemoryNode *head, MemoryNode *new) {
 	while (tr->next != NULL) tr = tr->next;
 	tr->next = new;
 }
-void printMList(MemoryNode *head, bool sequential, bool graphics) {
+void printMList(MemoryNode *head, bool sequential, bool graphics, bool timestamps) {
 	MemoryNode *tr = head;
 	MemoryNode *pre = NULL;
 	float memDiff = 0;
@@ -120,6 +150,9 @@ void printMList(MemoryNode *head, bool sequential, bool graphics) {
 			memDiff = tr->virtUsed - pre->virtUsed;
 		}
 		
+		// Seconds since first sample (sample times vary when sampling adaptively)
+		if (timestamps && (!sequential || tr->next == NULL)) printf("+%6.2fs  ", tr->timestamp - head->timestamp);
+		
 		if (sequential) {
 			if (tr->next == NULL) printf("%.2f GB / %.2f GB  -- %.2f GB / %.2f GB", tr->physUsed, tr->physTot, tr->virtUsed, tr->virtTot);
 			// else printf("\n");
@@ -143,6 +176,19 @@ void printMList(MemoryNode *head, bool sequential, bool graphics) {
 				printf("* %.2f", memDiff);
 			}
 			printf(" (%.2f)", tr->virtUsed);
+			
+			// Paging activity bar, 2 marks per decade of faults/swaps/stalls per sec
+			if (tr->hasVmstat) {
+				float activity = 0;
+				for (int r = 0; r < VMSTATRATES; r++) activity += tr->vmRates[r];
+				printf("  paging |");
+				for (int m = 0; m < 10 && activity >= 1; m++, activity /= 3.16) printf("!");
+			}
+		}
+		
+		// Paging/reclaim rates over the sample
+		if (tr->hasVmstat && (!sequential || tr->next == NULL)) {
+			printf("  flt %.0f swp %.0f/%.0f rcl %.0f cmp %.0f /s", tr->vmRates[0], tr->vmRates[1], tr->vmRates[2], tr->vmRates[3], tr->vmRates[4]);
 		}
 		
 		printf("\n");
@@ -162,13 +208,15 @@ void deleteMList(MemoryNode *head) {
 
 // Struct for storing samples of cpu usage in a linked list
 typedef struct CpuUseNode {
+	double timestamp;	// secs since epoch
 	float cpuUse;
 	struct CpuUseNode *next;
 } CpuUseNode;
 // Linked list operations
-CpuUseNode *newCNode(float cpuUse) {
+CpuUseNode *newCNode(double timestamp, float cpuUse) {
 	CpuUseNode *new = malloc(1 * sizeof(CpuUseNode));
 	if (new == NULL) fprintf(stderr, "Error allocating memory for CpuUseNode\n.");
+	new->timestamp = timestamp;
 	new->cpuUse = cpuUse;
 	new->next = NULL;
 	return new;
@@ -183,12 +231,16 @@ float getLastCpuUse(CpuUseNode *head) {
 	while (tr->next != NULL) tr = tr->next;
 	return tr->cpuUse;
 }
-void printCList(CpuUseNode *head, bool sequential) {
+// waitHeat: one row of per-cpu run-queue wait heat per sample (MAXSCHEDCPUS + 1 chars each), printed beside it, or NULL
+void printCList(CpuUseNode *head, bool sequential, bool timestamps, char *waitHeat) {
 	CpuUseNode *tr = head->next;
 	int lineCounter = 0;
 	while (tr != NULL) {
 		printf("\033[K\t");
 		if ((sequential && tr->next == NULL) || !sequential) {
+			if (timestamps) printf("+%6.2fs  ", tr->timestamp - head->next->timestamp);
+			char *heatRow = (waitHeat != NULL) ? waitHeat + lineCounter * (MAXSCHEDCPUS + 1) : NULL;
+			if (heatRow != NULL && heatRow[0] != '\0') printf("wait |%s|  ", heatRow);
 			printf("|||");
 			for (int a = 0; a < (int)(tr->cpuUse); a++) printf("|");
 			printf(" %.2f\n", tr->cpuUse);
@@ -211,6 +263,137 @@ void deleteCList(CpuUseNode *head) {
 	}
 }
 
+// Struct for summarizing the samples that fell within a span of time
+typedef struct RollupBucket {
+	double start;	// secs since epoch
+	float min;
+	float max;
+	float sum;
+	int count;
+} RollupBucket;
+// Struct for keeping the latest ROLLUPWIDTH buckets of one resolution in a ring
+typedef struct RollupTier {
+	double span;	// secs covered by each bucket, 0 for one bucket per sample
+	char *label;
+	RollupBucket buckets[ROLLUPWIDTH];	// completed buckets
+	int next;		// index in buckets to complete the next bucket at
+	long completed;	// buckets completed so far (including ones overwritten in the ring)
+	RollupBucket cur;	// bucket samples are currently added to
+} RollupTier;
+// Struct for storing the history of one statistic at multiple resolutions
+typedef struct Rollup {
+	RollupTier tiers[ROLLUPTIERS];
+	double first;	// secs since epoch
+	double last;	// secs since epoch
+	long count;
+} Rollup;
+// Rollup operations
+void initRollup(Rollup *rollup) {
+	static double spans[ROLLUPTIERS] = {0, 10, 60, 600, 3600};
+	static char *labels[ROLLUPTIERS] = {"raw", "10s", "1m", "10m", "1h"};
+	
+	memset(rollup, 0, sizeof(Rollup));
+	for (int t = 0; t < ROLLUPTIERS; t++) {
+		rollup->tiers[t].span = spans[t];
+		rollup->tiers[t].label = labels[t];
+	}
+}
+void addToRollup(Rollup *rollup, double timestamp, float value) {
+	if (rollup->count == 0) rollup->first = timestamp;
+	rollup->last = timestamp;
+	rollup->count++;
+	
+	for (int t = 0; t < ROLLUPTIERS; t++) {
+		RollupTier *tier = &rollup->tiers[t];
+		
+		// Complete current bucket once the sample falls past its span
+		if (tier->cur.count > 0 && timestamp >= tier->cur.start + tier->span) {
+			tier->buckets[tier->next] = tier->cur;
+			tier->next = (tier->next + 1) % ROLLUPWIDTH;
+			tier->completed++;
+			tier->cur.count = 0;
+		}
+		
+		if (tier->cur.count == 0) {
+			tier->cur.start = (tier->span > 0) ? (long)(timestamp / tier->span) * tier->span : timestamp;
+			tier->cur.min = value;
+			tier->cur.max = value;
+			tier->cur.sum = 0;
+		}
+		if (value < tier->cur.min) tier->cur.min = value;
+		if (value > tier->cur.max) tier->cur.max = value;
+		tier->cur.sum += value;
+		tier->cur.count++;
+	}
+}
+float getRollupRate(Rollup *rollup) {
+	if (rollup->count < 2 || rollup->last - rollup->first <= 0) return 0;
+	return (rollup->count - 1) / (rollup->last - rollup->first);
+}
+/* Prints the latest (up to) width buckets of the finest tier whose buckets cover the whole run,
+ * as a min/avg/max summary line followed (if graphics) by a sparkline of bucket averages scaled to [lo, hi].
+ * Returns the number of lines printed.
+ */
+int printRollup(Rollup *rollup, int width, float lo, float hi, bool graphics, char *unit) {
+	static char *levels[] = {"\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588"};
+	
+	if (rollup->count == 0) return 0;
+	if (width > ROLLUPWIDTH) width = ROLLUPWIDTH;
+	
+	// Coarsest tier is used if no tier covers the whole run
+	RollupTier *tier = &rollup->tiers[ROLLUPTIERS - 1];
+	for (int t = 0; t < ROLLUPTIERS; t++) {
+		if (rollup->tiers[t].completed + 1 <= width) {
+			tier = &rollup->tiers[t];
+			break;
+		}
+	}
+	
+	// Gather buckets from oldest to newest, current bucket last
+	int shown = (tier->completed + 1 < width) ? tier->completed + 1 : width;
+	RollupBucket *order[ROLLUPWIDTH];
+	for (int b = 0; b < shown - 1; b++) {
+		order[b] = &tier->buckets[(tier->next - (shown - 1) + b + ROLLUPWIDTH) % ROLLUPWIDTH];
+	}
+	order[shown - 1] = &tier->cur;
+	
+	float min = order[0]->min, max = order[0]->max, sum = 0;
+	int count = 0;
+	for (int b = 0; b < shown; b++) {
+		if (order[b]->min < min) min = order[b]->min;
+		if (order[b]->max > max) max = order[b]->max;
+		sum += order[b]->sum;
+		count += order[b]->count;
+	}
+	
+	printf("\033[K history (%d x %s): min %.2f%s  avg %.2f%s  max %.2f%s\n", shown, tier->label, min, unit, sum / count, unit, max, unit);
+	if (!graphics) return 1;
+	
+	printf("\033[K\t");
+	for (int b = 0; b < shown; b++) {
+		float avg = order[b]->sum / order[b]->count;
+		int level = (hi > lo) ? (int)((avg - lo) / (hi - lo) * 8) : 0;
+		if (level < 0) level = 0;
+		if (level > 7) level = 7;
+		printf("%s", levels[level]);
+	}
+	printf("\n");
+	return 2;
+}
+
+/* Returns the heat character for waitMs (ms per sec runnable tasks waited on a run queue),
+ * from ' ' (no waiting) through ".:-=+*#" to '@' (a task waiting the whole time).
+ */
+char getWaitHeat(float waitMs) {
+	static float bounds[] = {1, 10, 50, 100, 250, 500, 1000};
+	static char heat[] = ".:-=+*#@";
+	
+	if (waitMs <= 0) return ' ';
+	int level = 0;
+	while (level < 7 && waitMs >= bounds[level]) level++;
+	return heat[level];
+}
+
 /* Function for signal handler (SIGINT) in parent process
  * Prompts user if they want to quit the program, and
  * quits if given 'y'/'Y'; stays if given 'n'/'N'.
@@ -290,12 +473,150 @@ void customTerminateHandler(int code) {
 	_exit(0);
 }
 
+/*
+ * Function: runOptionalCollector
+ * ----------------------------
+ * Runs the collector of an optional role (--proc-events, --irq, --sched, --sockets, --numa) in its child:
+ * sets up its state, writes samples samples to writeFD, then tears the state down.
+ * Samples are taken over the CPU child's intervals, so the parent gets one of each per frame:
+ * a short first one (FIRSTCPUSAMPLE), then delay secs, or the interval read from paceFD before
+ * each sample if it isn't -1 (under --adaptive, where the CPU child picks its intervals as it goes).
+ *
+ * role: the optional ChildRole to collect for
+ * paceFD: read end of the pipe the CPU child writes each next interval to, or -1
+ *
+ * returns: 0 on success
+ *          -1 on error
+ */
+int runOptionalCollector(int role, int samples, int delay, int paceFD, int writeFD) {
+	// State of each collector (only role's is used)
+	int connFD = -1;
+	PidTable live;
+	IrqMatrix hardIrqs, softIrqs;
+	SchedStats schedStats;
+	SocketTable socketTable;
+	NumaNodes numaNodes;
+	
+	int res = 0;
+	switch (role) {
+		case PROC_EVENTS_CHILD:
+			// Prefer kernel events, fall back to rescanning /proc
+			connFD = openProcConnector();
+			if (connFD == -1) fprintf(stderr, "warn: netlink proc connector unavailable, polling /proc instead\n");
+			res = initLiveProcs(&live);
+			break;
+		case IRQ_CHILD:
+			res = initIrqMatrix(&hardIrqs, "/proc/interrupts");
+			if (res == 0) res = initIrqMatrix(&softIrqs, "/proc/softirqs");
+			break;
+		case SCHED_CHILD:
+			res = initSchedStats(&schedStats);
+			break;
+		case SOCKETS_CHILD:
+			res = initSocketTable(&socketTable);
+			break;
+		case NUMA_CHILD:
+			res = initNumaNodes(&numaNodes);
+			break;
+		default:
+			return -1;
+	}
+	if (res == -1) return -1;
+	
+	for (int j = 0; j < samples && res == 0; j++) {
+		double sampleDelay = delay;
+		if (j == 0) sampleDelay = FIRSTCPUSAMPLE;
+		else if (paceFD != -1 && read(paceFD, &sampleDelay, sizeof(double)) <= 0) {
+			fprintf(stderr, "Could not read sample interval from CPU pace pipe\n");
+			return -1;
+		}
+		
+		switch (role) {
+			case PROC_EVENTS_CHILD:
+				res = writeProcEventDataToPipe(connFD, &live, sampleDelay, writeFD);
+				break;
+			case IRQ_CHILD:
+				res = writeIrqDataToPipe(&hardIrqs, &softIrqs, sampleDelay, writeFD);
+				break;
+			case SCHED_CHILD:
+				res = writeSchedDataToPipe(&schedStats, sampleDelay, writeFD);
+				break;
+			case SOCKETS_CHILD:
+				res = writeSocketDataToPipe(&socketTable, sampleDelay, writeFD);
+				break;
+			case NUMA_CHILD:
+				res = writeNumaDataToPipe(&numaNodes, sampleDelay, writeFD);
+				break;
+		}
+	}
+	
+	switch (role) {
+		case PROC_EVENTS_CHILD:
+			freePidTable(&live);
+			if (connFD != -1 && close(connFD) == -1) {
+				perror("close");
+			}
+			break;
+		case IRQ_CHILD:
+			freeIrqMatrix(&hardIrqs);
+			freeIrqMatrix(&softIrqs);
+			break;
+		case SCHED_CHILD:
+			freeSchedStats(&schedStats);
+			break;
+		case SOCKETS_CHILD:
+			freeSocketTable(&socketTable);
+			break;
+		case NUMA_CHILD:
+			freeNumaNodes(&numaNodes);
+			break;
+	}
+	
+	return res;
+}
+
 int main(int argc, char **argv) {
 	/* Initialize variables and CLAs */
+	double startTime = getTimestamp();
+	double firstFrameTime = -1;
+	
+	// Subcommand: system_monitor merge [--bucket=SECS] [--top=N] FILE...
+	if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+		int bucketSecs = 60, topHosts = 5;
+		int firstFile = 2;
+		
+		for (; firstFile < argc && strncmp(argv[firstFile], "--", 2) == 0; firstFile++) {
+			int bucketRes = extractFlagValue(argv[firstFile], "bucket");
+			int topRes = extractFlagValue(argv[firstFile], "top");
+			
+			if (bucketRes > 0) bucketSecs = bucketRes;
+			else if (topRes > 0) topHosts = topRes;
+			else {
+				fprintf(stderr, "args: unsupported merge argument: \"%s\"\n", argv[firstFile]);
+				return 1;
+			}
+		}
+		
+		return (mergeRecordings(argv + firstFile, argc - firstFile, bucketSecs, topHosts) == -1) ? 1 : 0;
+	}
 	
 	// Default program arguments
-	bool system = false, user = false, graphics = false, sequential = false;
+	bool system = false, user = false, graphics = false, sequential = false, adaptive = false, selfProfile = false;
+	bool procEvents = false, irqs = false, sched = false, sockets = false, vmstat = false, numa = false;
 	int samples = 10, delay = 1;
+	int minDelayMs = 250, maxDelayMs = -1, threshold = 5;	// adaptive sampling (maxDelayMs defaults to delay)
+	
+	// Alert rules, compiled once here and checked by the collectors as they sample
+	AlertSet alerts;
+	alerts.count = 0;
+	alerts.metrics = 0;
+	alerts.hook = NULL;
+	alerts.logFD = -1;
+	char *alertLogPath = NULL;
+	
+	// Recording of samples, appended to by each collector
+	char *recordPath = NULL;
+	int recordFD = -1;
 	
 	bool sawSamplesPosArg = false;
 	bool sawAllPosArgs = false;
@@ -321,6 +642,65 @@ int main(int argc, char **argv) {
 			sequential = true;
 			brokePosArg = true;
 		}
+		else if (strncmp(argv[i], "--irq", 5) == 0) {
+			irqs = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--numa", 6) == 0) {
+			numa = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--vmstat", 8) == 0) {
+			vmstat = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--sockets", 9) == 0) {
+			sockets = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--sched", 7) == 0) {
+			sched = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--proc-events", 13) == 0) {
+			procEvents = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--self-profile", 14) == 0) {
+			selfProfile = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--adaptive", 10) == 0) {
+			adaptive = true;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--alert-hook=", 13) == 0) {
+			alerts.hook = argv[i] + 13;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--record=", 9) == 0) {
+			recordPath = argv[i] + 9;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--alert-log=", 12) == 0) {
+			alertLogPath = argv[i] + 12;
+			brokePosArg = true;
+		}
+		else if (strncmp(argv[i], "--alert=", 8) == 0 || strcmp(argv[i], "--alert") == 0) {
+			char *rule = argv[i] + 8;
+			
+			// Rule given as the next argument
+			if (argv[i][7] == '\0') {
+				if (i + 1 == argc) {
+					fprintf(stderr, "args: --alert must be followed by a rule\n");
+					return 1;
+				}
+				rule = argv[++i];
+			}
+			
+			if (compileAlertRule(&alerts, rule) == -1) return 1;
+			brokePosArg = true;
+		}
 		else {
 			char *leftover;
 			long numArg = strtol(argv[i], &leftover, 10);
@@ -357,9 +737,12 @@ int main(int argc, char **argv) {
 				
 				int samplesRes = extractFlagValue(argv[i], "samples");
 				int delayRes = extractFlagValue(argv[i], "tdelay");
+				int minDelayRes = extractFlagValue(argv[i], "tmin");
+				int maxDelayRes = extractFlagValue(argv[i], "tmax");
+				int thresholdRes = extractFlagValue(argv[i], "threshold");
 				
 				// No remaining possible arguments that match argv[i]
-				if (samplesRes < 0 && delayRes < 0) {
+				if (samplesRes < 0 && delayRes < 0 && minDelayRes < 0 && maxDelayRes < 0 && thresholdRes < 0) {
 					fprintf(stderr, "args: unsupported argument: \"%s\"\n", argv[i]);
 					return 1;
 				}
@@ -372,6 +755,9 @@ int main(int argc, char **argv) {
 					delay = delayRes;
 					sawFlaggedDelay = true;
 				}
+				else if (minDelayRes > 0) minDelayMs = minDelayRes;
+				else if (maxDelayRes > 0) maxDelayMs = maxDelayRes;
+				else if (thresholdRes > 0) threshold = thresholdRes;
 				else {
 					fprintf(stderr, "args: something went wrong\n");
 					return 1;
@@ -385,21 +771,79 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 	
+	if (alertLogPath != NULL) {
+		alerts.logFD = open(alertLogPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (alerts.logFD == -1) {
+			perror("open");
+			return 1;
+		}
+	}
+	
+	if (recordPath != NULL) {
+		recordFD = open(recordPath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+		if (recordFD == -1) {
+			perror("open");
+			return 1;
+		}
+		
+		// Header naming the host, for merging recordings of many hosts
+		struct utsname hostInfo;
+		char header[MAXSIZE];
+		uname(&hostInfo);
+		int len = snprintf(header, MAXSIZE, "# system_monitor recording host=%s\n", hostInfo.nodename);
+		if (write(recordFD, header, len) == -1) {
+			perror("write");
+			return 1;
+		}
+	}
+	
+	if (maxDelayMs == -1) maxDelayMs = delay * 1000;
+	if (adaptive && minDelayMs > maxDelayMs) {
+		fprintf(stderr, "args: --tmin cannot be greater than --tmax\n");
+		return 1;
+	}
+	
 	// Declare linked lists to store system statistics
 	MemoryNode *memoryHead = NULL;
 	CpuUseNode *cpuHead = NULL;
 	
 	// Dummy first node
-	cpuHead = newCNode(0);
+	cpuHead = newCNode(0, 0);
 	
-	/* Fork thrice, pass info to children to determine their task */
+	/* Fork thrice (plus once per optional collector), pass info to children to determine their task */
 	pid_t forkRet;
+	int roles[CHILD_ROLES];
+	int children = 0;
+	roles[children++] = MEMORY_CHILD;
+	roles[children++] = USERS_CHILD;
+	roles[children++] = CPU_CHILD;
+	if (procEvents) roles[children++] = PROC_EVENTS_CHILD;
+	if (irqs) roles[children++] = IRQ_CHILD;
+	if (sched) roles[children++] = SCHED_CHILD;
+	if (sockets) roles[children++] = SOCKETS_CHILD;
+	if (numa) roles[children++] = NUMA_CHILD;
 	
-	// Initiate pipes
-	int memFD[2], userFD[2], cpuFD[2];
-	if (pipe(memFD) == -1 || pipe(userFD) == -1 || pipe(cpuFD) == -1) {
-		perror("pipe");
-		exit(1);
+	// Initiate pipes (one per role, whether or not its child is forked)
+	int pipeFDs[CHILD_ROLES][2];
+	for (int r = 0; r < CHILD_ROLES; r++) {
+		if (pipe(pipeFDs[r]) == -1) {
+			perror("pipe");
+			exit(1);
+		}
+	}
+	int *memFD = pipeFDs[MEMORY_CHILD], *userFD = pipeFDs[USERS_CHILD], *cpuFD = pipeFDs[CPU_CHILD];
+	int *procFD = pipeFDs[PROC_EVENTS_CHILD], *irqFD = pipeFDs[IRQ_CHILD], *schedFD = pipeFDs[SCHED_CHILD];
+	int *socketFD = pipeFDs[SOCKETS_CHILD], *numaFD = pipeFDs[NUMA_CHILD];
+	
+	// Under --adaptive, the CPU child writes each next sample interval to every other collector (pace pipes),
+	// so all of them sample in step and the parent gets one sample of each per frame
+	int paceFDs[CHILD_ROLES][2];
+	for (int r = 0; r < CHILD_ROLES; r++) paceFDs[r][0] = paceFDs[r][1] = -1;
+	for (int i = 0; adaptive && i < children; i++) {
+		if (roles[i] != CPU_CHILD && pipe(paceFDs[roles[i]]) == -1) {
+			perror("pipe");
+			exit(1);
+		}
 	}
 	
 	// Child processes should ignore SIGINT (parent modifies SIGINT handler later)
@@ -419,8 +863,9 @@ int main(int argc, char **argv) {
 	sigemptyset(&termact.sa_mask);
 	sigaction(SIGTERM, &termact, NULL);
 	
-	// Fork 3 children
-	for (int i = 0; i < 3; i++) {
+	// Fork children
+	for (int i = 0; i < children; i++) {
+		int role = roles[i];
 		forkRet = fork();
 		
 		if (forkRet == 0) {
@@ -433,22 +878,73 @@ int main(int argc, char **argv) {
 			
 			// Child process should delete dummy node for CPU list
 			deleteCList(cpuHead);
+			
+			// Close the pipes of the other children, so the parent isn't kept waiting on a pipe whose child has exited
+			for (int k = 0; k < CHILD_ROLES; k++) {
+				if (k == role) continue;
+				if (close(pipeFDs[k][0]) == -1 || close(pipeFDs[k][1]) == -1) {
+					perror("close");
+				}
+			}
+			
+			// Only the CPU child writes pace pipes, and each other collector reads its own
+			for (int k = 0; k < CHILD_ROLES; k++) {
+				if (paceFDs[k][0] == -1) continue;
+				if ((k != role && close(paceFDs[k][0]) == -1) || (role != CPU_CHILD && close(paceFDs[k][1]) == -1)) {
+					perror("close");
+				}
+			}
 		}
 		
 		// Child for getting MEMORY USAGE (1)
-		if (forkRet == 0 && i == 0) {
+		if (forkRet == 0 && role == MEMORY_CHILD) {
 			// Close read end of pipe
 			if (close(memFD[0]) == -1) {
 				perror("close");
 			}
 			
+			// Paging/reclaim counters, sent after each memory sample
+			VmstatCounters vmCounters;
+			if (vmstat && initVmstatCounters(&vmCounters) == -1) exit(1);
+			
 			for (int j = 0; j < samples; j++) {
+				float memData[4];
+				
 				// Check writing memory data to pipe was successful
-				if (writeMemoryDataToPipe(memFD[1]) == -1) exit(1);
+				if (writeMemoryDataToPipe(memFD[1], memData) == -1) exit(1);
+				if (vmstat && writeVmstatDataToPipe(&vmCounters, memFD[1]) == -1) exit(1);
+				
+				float usedPercent = (memData[1] == 0) ? 0 : 100 * memData[0] / memData[1];
+				double sampleTime = getTimestamp();
+				checkAlerts(&alerts, ALERT_MEM_USED, memData[0], sampleTime);
+				checkAlerts(&alerts, ALERT_MEM_PCT, usedPercent, sampleTime);
+				checkAlerts(&alerts, ALERT_VIRT_USED, memData[2], sampleTime);
 				
-				sleep(delay);
+				// Free memory understates what is available on hosts with page cache, so MemAvailable is used (read only if needed)
+				if (alerts.metrics & (1u << ALERT_MEM_AVAIL)) {
+					float memAvailable = getMemAvailable();
+					if (memAvailable < 0) memAvailable = memData[1] - memData[0];
+					checkAlerts(&alerts, ALERT_MEM_AVAIL, memAvailable, sampleTime);
+				}
+				if (recordFD != -1 && writeRecordLine(recordFD, sampleTime, "mem", memData, 4) == -1) exit(1);
+				
+				// No need to wait after the last sample
+				if (j == samples - 1) break;
+				
+				// Under --adaptive, wait as long as the CPU child's next sample takes
+				if (adaptive) {
+					double nextDelay;
+					if (read(paceFDs[role][0], &nextDelay, sizeof(double)) <= 0) {
+						fprintf(stderr, "Could not read sample interval from CPU pace pipe\n");
+						exit(1);
+					}
+					sleepFor(nextDelay);
+				}
+				else sleep(delay);
 			}
 			
+			if (vmstat) freeVmstatCounters(&vmCounters);
+			
 			// Close write end of pipe
 			if (close(memFD[1]) == -1) {
 				perror("close");
@@ -458,31 +954,56 @@ int main(int argc, char **argv) {
 		}
 		
 		// Child for getting CONNECTED USERS (2)
-		else if (forkRet == 0 && i == 1) {
+		else if (forkRet == 0 && role == USERS_CHILD) {
 			// Close read end of pipe
 			if (close(userFD[0]) == -1) {
 				perror("close");
 			}
 			
-			// Open /var/run/utmp in read bin mode
+			// Open /var/run/utmp in read bin mode (per-user totals are still shown without it)
 			FILE *usersFile;
 			usersFile = fopen("/var/run/utmp", "rb");
 			if (usersFile == NULL) {
-				fprintf(stderr, "error: /var/run/utmp could not be opened\n");
-				exit(1);
+				fprintf(stderr, "warn: /var/run/utmp could not be opened, sessions will not be shown\n");
 			}
 			
+			// Per-user resource usage, joined with the sessions (the /proc scan is skipped when the section is hidden)
+			UserUsageTable usage;
+			if (initUserUsage(&usage) == -1) exit(1);
+			bool scanUsers = user || !system;
+			
 			for (int j = 0; j < samples; j++) {
+				int sessions;
+				
 				// Reset file pointer to beginning of file (updates file as well)
-				if (fseek(usersFile, SEEK_SET, SEEK_SET) != 0) {
+				if (usersFile != NULL && fseek(usersFile, SEEK_SET, SEEK_SET) != 0) {
 					fprintf(stderr, "error: fseek was not successful\n");
 					return -1;
 				}
 				
+				if (scanUsers && updateUserUsage(&usage) == -1) exit(1);
+				
 				// Check writing user data to pipe was successful
-				if (writeUserDataToPipe(usersFile, userFD[1]) == -1) exit(1);
+				if (writeUserDataToPipe(usersFile, userFD[1], &sessions, scanUsers ? &usage : NULL) == -1) exit(1);
+				
+				double sampleTime = getTimestamp();
+				float sessionCount = sessions;
+				checkAlerts(&alerts, ALERT_USERS, sessions, sampleTime);
+				if (recordFD != -1 && writeRecordLine(recordFD, sampleTime, "users", &sessionCount, 1) == -1) exit(1);
+				
+				// No need to wait after the last sample
+				if (j == samples - 1) break;
 				
-				sleep(delay);
+				// Under --adaptive, wait as long as the CPU child's next sample takes (see memory child)
+				if (adaptive) {
+					double nextDelay;
+					if (read(paceFDs[role][0], &nextDelay, sizeof(double)) <= 0) {
+						fprintf(stderr, "Could not read sample interval from CPU pace pipe\n");
+						exit(1);
+					}
+					sleepFor(nextDelay);
+				}
+				else sleep(delay);
 			}
 			
 			// Close write end of pipe
@@ -490,8 +1011,10 @@ int main(int argc, char **argv) {
 				perror("close");
 			}
 			
+			freeUserUsage(&usage);
+			
 			// Close /var/run/utmp
-			if (fclose(usersFile) != 0) {
+			if (usersFile != NULL && fclose(usersFile) != 0) {
 				fprintf(stderr, "error: /var/run/utmp could not be closed\n");
 				exit(1);
 			}
@@ -500,7 +1023,7 @@ int main(int argc, char **argv) {
 		}
 		
 		// Child for getting CPU USAGE (3)
-		else if (forkRet == 0 && i == 2) {
+		else if (forkRet == 0 && role == CPU_CHILD) {
 			// Close read end of pipe
 			if (close(cpuFD[0]) == -1) {
 				perror("close");
@@ -514,19 +1037,39 @@ int main(int argc, char **argv) {
 				exit(1);
 			}
 			
+			AdaptiveDelay rate;
+			initAdaptiveDelay(&rate, minDelayMs / 1000.0, maxDelayMs / 1000.0, threshold);
+			
 			for (int j = 0; j < samples; j++) {
 				// Reset file pointer to beginning
 				fseek(cpuInfo, SEEK_SET, SEEK_SET);
 				
-				int cpuSampleDelay;
+				double cpuSampleDelay;
+				float cpuUsage;
 				
-				// Only sample for 1s on first iteration
-				if (j == 0) cpuSampleDelay = 1;
+				// Only take a short baseline sample on first iteration, so the first frame shows up right away
+				if (j == 0) cpuSampleDelay = FIRSTCPUSAMPLE;
+				// Else sample for the adaptive delay
+				else if (adaptive) cpuSampleDelay = rate.curDelay;
 				// Else sample for (delay) seconds
 				else cpuSampleDelay = delay;
 				
 				// Check writing user data to pipe was successful
-				if (writeCPUDataToPipe(cpuInfo, cpuSampleDelay, cpuFD[1]) == -1) exit(1);
+				if (writeCPUDataToPipe(cpuInfo, cpuSampleDelay, cpuFD[1], &cpuUsage) == -1) exit(1);
+				
+				double sampleTime = getTimestamp();
+				checkAlerts(&alerts, ALERT_CPU, cpuUsage, sampleTime);
+				if (recordFD != -1 && writeRecordLine(recordFD, sampleTime, "cpu", &cpuUsage, 1) == -1) exit(1);
+				
+				if (adaptive) nextAdaptiveDelay(&rate, cpuUsage);
+				
+				// Every other collector takes its next sample over the same interval
+				for (int k = 0; adaptive && j < samples - 1 && k < CHILD_ROLES; k++) {
+					if (paceFDs[k][1] != -1 && write(paceFDs[k][1], &rate.curDelay, sizeof(double)) == -1) {
+						perror("write");
+						exit(1);
+					}
+				}
 				
 				// No delay necessary, as writeCPUDataToPipe already delays for appropriate time
 			}
@@ -545,6 +1088,23 @@ int main(int argc, char **argv) {
 			exit(0);
 		}
 		
+		// Child for an OPTIONAL COLLECTOR (4+)
+		else if (forkRet == 0) {
+			// Close read end of pipe
+			if (close(pipeFDs[role][0]) == -1) {
+				perror("close");
+			}
+			
+			int res = runOptionalCollector(role, samples, delay, paceFDs[role][0], pipeFDs[role][1]);
+			
+			// Close write end of pipe (and pace pipe from the CPU child)
+			if (close(pipeFDs[role][1]) == -1 || (paceFDs[role][0] != -1 && close(paceFDs[role][0]) == -1)) {
+				perror("close");
+			}
+			
+			exit((res == -1) ? 1 : 0);
+		}
+		
 		else if (forkRet < 0) {
 			perror("fork");
 			exit(1);
@@ -563,17 +1123,72 @@ int main(int argc, char **argv) {
 	// Parent should ignore custom signal (used for children)
 	sigaction(SIGUSR1, &ignact, NULL);
 	
-	// Close write end of pipes
-	if (close(memFD[1]) == -1 || close(userFD[1]) == -1 || close(cpuFD[1]) == -1) {
+	// Close write end of pipes, and read end of pipes of optional collectors not forked
+	for (int r = 0; r < CHILD_ROLES; r++) {
+		if (close(pipeFDs[r][1]) == -1) {
+			perror("close");
+		}
+		if (paceFDs[r][0] != -1 && (close(paceFDs[r][0]) == -1 || close(paceFDs[r][1]) == -1)) {
+			perror("close");
+		}
+	}
+	if ((!procEvents && close(procFD[0]) == -1) || (!irqs && close(irqFD[0]) == -1) || (!sched && close(schedFD[0]) == -1)
+	    || (!sockets && close(socketFD[0]) == -1) || (!numa && close(numaFD[0]) == -1)) {
 		perror("close");
 	}
 	
 	// Initial variables before entering loop
 	int cores = -1;
+	long totalShortLived = 0;
+	MemoryNode *memoryTail = NULL;
+	CpuUseNode *cpuTail = cpuHead;
+	char *waitHeat = NULL;	// one row of per-cpu run-queue wait heat per sample (only the latest kept unless heatWithCpu)
+	
+	// History of samples at multiple resolutions, for runs too long to list every sample
+	Rollup memRollup, cpuRollup;
+	initRollup(&memRollup);
+	initRollup(&cpuRollup);
+	
+	// Lines of the optional sections, which don't grow with the samples
+	int sectionLines = 0;
+	if (!user || system) {
+		int numaIDs[MAXNUMANODES];
+		int numaNodes = numa ? listNumaNodes(numaIDs) : 0;
+		if (sched) sectionLines += 5;
+		if (numa) sectionLines += 2 + ((numaNodes > 0) ? numaNodes : 0);
+		if (sockets) sectionLines += 5 + TOPPEERS;
+		if (procEvents) sectionLines += 5;
+		if (irqs) sectionLines += 3 + TOPIRQS;
+	}
+	
+	// List every sample only if a frame of them fits the terminal (~16 lines go to other output)
+	struct winsize term;
+	bool compact = false;
+	int historyWidth = ROLLUPWIDTH;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &term) == 0 && term.ws_row > 0) {
+		compact = samples * (graphics ? 2 : 1) + 16 + sectionLines > term.ws_row;
+		if (term.ws_col - 10 < historyWidth) historyWidth = term.ws_col - 10;
+		if (historyWidth < 1) historyWidth = 1;
+	}
+	
+	// Wait heat rows go beside the cpu graph when every sample is listed, else the latest one goes in the scheduler section
+	bool heatWithCpu = sched && graphics && !compact;
+	if (sched) {
+		waitHeat = calloc((heatWithCpu ? samples : 1), MAXSCHEDCPUS + 1);
+		if (waitHeat == NULL) {
+			fprintf(stderr, "Error allocating memory for run-queue wait history\n");
+			exit(1);
+		}
+	}
 	
 	for (int i = 0; i < samples; i++) {
 		// Read data from child handling memory usage
+		double memTimestamp;
 		float memData[4];
+		if (read(memFD[0], &memTimestamp, sizeof(double)) <= 0) {
+			fprintf(stderr, "Could not read timestamp from memory pipe\n");
+			exit(1);
+		}
 		for (int j = 0; j < 4; j++) {
 			if (read(memFD[0], &memData[j], sizeof(float)) <= 0) {
 				fprintf(stderr, "Could not read 4 elements from memory pipe\n");
@@ -581,12 +1196,28 @@ int main(int argc, char **argv) {
 			}
 		}
 		
+		float vmRates[VMSTATRATES];
+		if (vmstat && read(memFD[0], vmRates, sizeof(vmRates)) <= 0) {
+			fprintf(stderr, "Could not read vmstat rates from memory pipe\n");
+			exit(1);
+		}
+		
 		// Add to memory linked list
-		if (memoryHead == NULL) memoryHead = newMNode(memData[0], memData[1], memData[2], memData[3]);
-		else {
-			MemoryNode *new = newMNode(memData[0], memData[1], memData[2], memData[3]);
-			insertMAtTail(memoryHead, new);
+		MemoryNode *newMem = newMNode(memTimestamp, memData[0], memData[1], memData[2], memData[3]);
+		if (vmstat) {
+			newMem->hasVmstat = true;
+			memcpy(newMem->vmRates, vmRates, sizeof(vmRates));
 		}
+		if (memoryHead == NULL) memoryHead = newMem;
+		else if (compact) {
+			// The rollups hold the history in compact mode, so only the latest sample is kept (in place, as handler holds memoryHead)
+			*memoryHead = *newMem;
+			free(newMem);
+			newMem = memoryHead;
+		}
+		else insertMAtTail(memoryTail, newMem);
+		memoryTail = newMem;
+		addToRollup(&memRollup, memTimestamp, memData[2]);
 		
 		// Now that both memoryHead and cpuHead exist, call handler and initialize static pointers to linked lists
 		handler(-999, memoryHead, cpuHead);	// call handler w/ mock signal to initialize static pointers to linked list
@@ -601,15 +1232,27 @@ int main(int argc, char **argv) {
 		
 		// Print initial data (samples, delay, self-memory utilization)
 		if (sequential) printf("\n>>> iteration %d \n", i);
+		else if (adaptive) printf("Nbr of samples: %d -- adaptively every %.2f-%.2f secs\n", samples, minDelayMs / 1000.0, maxDelayMs / 1000.0);
 		else printf("Nbr of samples: %d -- every %d secs\n", samples, delay);
 		printf(" Memory usage: %ld kilobytes\n", curProgMem);
 		printSectionLine();
 		
 		/* Print memory usage (system-wide) */
 		if (!user || system) {
-			printf("### Memory ### (Phys.Used/Tot -- Virtual Used/Tot)\n");
-			printMList(memoryHead, sequential, graphics);
-			for (int j = 0; j < samples - i - 1; j++) printf("\n");		// fill blank space for memory section
+			printf("### Memory ### (Phys.Used/Tot -- Virtual Used/Tot)");
+			if (vmstat) printf(" (major faults, swap in/out, direct reclaim, compaction stalls per sec)");
+			printf("\n");
+			if (adaptive) printf(" effective sample rate = %.2f samples/s\n", getRollupRate(&memRollup));
+			if (compact) {
+				printf("%.2f GB / %.2f GB  -- %.2f GB / %.2f GB", memData[0], memData[1], memData[2], memData[3]);
+				if (vmstat) printf("  flt %.0f swp %.0f/%.0f rcl %.0f cmp %.0f /s", vmRates[0], vmRates[1], vmRates[2], vmRates[3], vmRates[4]);
+				printf("\n");
+				printRollup(&memRollup, historyWidth, 0, memData[3], graphics, " GB");
+			}
+			else {
+				printMList(memoryHead, sequential, graphics, adaptive);
+				for (int j = 0; j < samples - i - 1; j++) printf("\n");		// fill blank space for memory section
+			}
 			printSectionLine();
 		}
 		
@@ -628,6 +1271,8 @@ int main(int argc, char **argv) {
 		
 		/* Print CPU usage */
 		float cpuUsage;
+		double cpuTimestamp;
+		int cpuHistoryLines = 0;
 		
 		if (!user || system) {
 			if (cores == -1) printf("Number of cores: \n");		// num cores not initialized by CPU child process yet
@@ -635,8 +1280,10 @@ int main(int argc, char **argv) {
 		}
 		
 		if (cpuHead->next != NULL && (!user || system)) {
-			printf(" total cpu use = %.2f%%\n", getLastCpuUse(cpuHead));
-			if (graphics) printCList(cpuHead, sequential);
+			printf(" total cpu use = %.2f%%\n", getLastCpuUse(cpuTail));
+			if (adaptive) printf(" effective sample rate = %.2f samples/s\n", getRollupRate(&cpuRollup));
+			if (compact) printf("\033[%dA", printRollup(&cpuRollup, historyWidth, 0, 100, graphics, "%"));
+			else if (graphics) printCList(cpuHead, sequential, adaptive, heatWithCpu ? waitHeat : NULL);
 		}
 		
 		// Read from child handling CPU usage
@@ -648,30 +1295,195 @@ int main(int argc, char **argv) {
 			fprintf(stderr, "Could not read cpuUsage from pipe\n");
 			exit(1);
 		}
+		if (read(cpuFD[0], &cpuTimestamp, sizeof(double)) <= 0) {
+			fprintf(stderr, "Could not read cpu timestamp from pipe\n");
+			exit(1);
+		}
 		
 		// Write new cpu usage stat to linked list
-		CpuUseNode *new = newCNode(cpuUsage);
-		insertCAtTail(cpuHead, new);
+		CpuUseNode *new = newCNode(cpuTimestamp, cpuUsage);
+		insertCAtTail(cpuTail, new);
+		
+		// Only the latest sample is kept in compact mode (see memory list)
+		if (compact && cpuTail != cpuHead) {
+			cpuHead->next = new;
+			free(cpuTail);
+		}
+		cpuTail = new;
+		addToRollup(&cpuRollup, cpuTimestamp, cpuUsage);
+		
+		// Read scheduler sample (taken over the same interval) before redrawing the cpu graph, so its heat row is there
+		SchedSample schedSample;
+		int maxWaitCpu = 0;
+		float totalSlices = 0;
+		if (sched) {
+			if (read(schedFD[0], &schedSample, sizeof(SchedSample)) <= 0) {
+				fprintf(stderr, "Could not read scheduler statistics from pipe\n");
+				exit(1);
+			}
+			
+			char *row = waitHeat + (heatWithCpu ? i : 0) * (MAXSCHEDCPUS + 1);
+			for (int c = 0; c < schedSample.cpus; c++) {
+				row[c] = getWaitHeat(schedSample.waitMs[c]);
+				if (schedSample.waitMs[c] > schedSample.waitMs[maxWaitCpu]) maxWaitCpu = c;
+				totalSlices += schedSample.slices[c];
+			}
+			row[schedSample.cpus] = '\0';
+		}
 		
 		// Update (print) cpu usage without clearing screen
 		if (!user || system) {
 			if (i > 0) printf("\033[1A\033[K");	// to refresh cpu usage without clearing entire screen
+			if (i > 0 && adaptive) printf("\033[1A\033[K");
 			printf("\033[1A\033[K");
 			printf("Number of cores: %d\n", cores);
-			printf(" total cpu use = %.2f%%\n", getLastCpuUse(cpuHead));
-			if (graphics) printCList(cpuHead, sequential);
+			printf(" total cpu use = %.2f%%\n", getLastCpuUse(cpuTail));
+			if (adaptive) printf(" effective sample rate = %.2f samples/s\n", getRollupRate(&cpuRollup));
+			if (compact) {
+				cpuHistoryLines = printRollup(&cpuRollup, historyWidth, 0, 100, graphics, "%");
+				printf("\033[%dA", cpuHistoryLines);
+			}
+			else if (graphics) printCList(cpuHead, sequential, adaptive, heatWithCpu ? waitHeat : NULL);
+		}
+		
+		// Realign output pointer
+		if (compact && cpuHistoryLines > 0) printf("\033[%dB", cpuHistoryLines);
+		else if (!compact && graphics) printf("\033[%dB", i + 1);
+		
+		/* Print scheduler load and run-queue wait (its heat rows are beside the cpu graph if heatWithCpu) */
+		if (sched) {
+			if (!user || system) {
+				printSectionLine();
+				printf("### Scheduler ### (run-queue wait per CPU, ms/s: ' ' 0 . <1 : <10 - <50 = <100 + <250 * <500 # <1000 @)\n");
+				printf(" load avg = %.2f %.2f %.2f  tasks running/total = %d/%d\n", schedSample.load[0], schedSample.load[1], schedSample.load[2], schedSample.running, schedSample.total);
+				if (schedSample.cpus == 0) printf(" run-queue wait n/a (no /proc/schedstat)\n");
+				else {
+					printf(" max wait = %.2f ms/s on CPU%d  timeslices/s = %.2f\n", schedSample.waitMs[maxWaitCpu], maxWaitCpu, totalSlices);
+					if (!heatWithCpu) printf("\twait |%s|\n", waitHeat);
+				}
+			}
+		}
+		
+		/* Print per-node memory, flagging nodes much fuller than others */
+		if (numa) {
+			NumaSample numaSample;
+			if (read(numaFD[0], &numaSample, sizeof(NumaSample)) <= 0) {
+				fprintf(stderr, "Could not read NUMA node memory from pipe\n");
+				exit(1);
+			}
+			
+			// Nodes without memory (cpu-only, some CXL) are left out of the spread
+			float minUsed = 100, maxUsed = 0;
+			int memoryNodes = 0;
+			for (int k = 0; k < numaSample.count; k++) {
+				NumaNodeSample *node = &numaSample.nodes[k];
+				if (node->memTotal == 0) continue;
+				
+				float used = 100 * (node->memTotal - node->memFree) / node->memTotal;
+				if (used < minUsed) minUsed = used;
+				if (used > maxUsed) maxUsed = used;
+				memoryNodes++;
+			}
+			if (memoryNodes == 0) minUsed = maxUsed = 0;
+			
+			if (!user || system) {
+				printSectionLine();
+				printf("### NUMA nodes ### (used%% spread = %.0f pts%s)\n", maxUsed - minUsed, (maxUsed - minUsed >= NUMAIMBALANCE) ? ", IMBALANCED" : "");
+				for (int k = 0; k < numaSample.count; k++) {
+					NumaNodeSample *node = &numaSample.nodes[k];
+					float used = (node->memTotal == 0) ? 0 : 100 * (node->memTotal - node->memFree) / node->memTotal;
+					
+					printf(" node%-2d %.2f GB / %.2f GB |", node->id, node->memTotal - node->memFree, node->memTotal);
+					for (int b = 0; b < 10; b++) printf("%c", (b < (int)(used / 10 + 0.5)) ? '#' : ' ');
+					printf("| file %.2f GB  anon %.2f GB  huge %d/%d free", node->filePages, node->anonPages, node->hugeFree, node->hugeTotal);
+					printf("  hit/s %.0f  miss/s %.0f", node->hitRate, node->missRate);
+					if (node->memTotal == 0) printf("  (no memory)");
+					else if (memoryNodes > 1 && maxUsed - minUsed >= NUMAIMBALANCE && used == maxUsed) printf("  <- fullest");
+					printf("\n");
+				}
+			}
 		}
 		
-		if (graphics) printf("\033[%dB", i + 1);	// Realign output pointer
+		/* Print TCP socket summary */
+		if (sockets) {
+			SocketSample socketSample;
+			if (read(socketFD[0], &socketSample, sizeof(SocketSample)) <= 0) {
+				fprintf(stderr, "Could not read socket summary from pipe\n");
+				exit(1);
+			}
+			
+			if (!user || system) {
+				printSectionLine();
+				printf("### TCP connections ### (%ld sockets, scanned in %.2f ms)\n", socketSample.total, socketSample.scanMs);
+				printf(" by state:");
+				for (int k = 1; k < TCPSTATES; k++) {
+					if (socketSample.states[k] > 0) printf(" %s=%ld", tcpStateNames[k], socketSample.states[k]);
+				}
+				printf("\n by local port:");
+				for (int k = 0; k < socketSample.portCount; k++) printf(" %u=%u", socketSample.ports[k].port, socketSample.ports[k].count);
+				printf("\n top remote peers:\n");
+				for (int k = 0; k < socketSample.peerCount; k++) {
+					if (socketSample.peers[k].error > 0) printf("  %-40s %ld (+/-%ld)\n", socketSample.peers[k].addr, socketSample.peers[k].count, socketSample.peers[k].error);
+					else printf("  %-40s %ld\n", socketSample.peers[k].addr, socketSample.peers[k].count);
+				}
+			}
+		}
+		
+		/* Print process lifecycle events */
+		if (procEvents) {
+			ProcEventSample procSample;
+			if (read(procFD[0], &procSample, sizeof(ProcEventSample)) <= 0) {
+				fprintf(stderr, "Could not read process events from pipe\n");
+				exit(1);
+			}
+			totalShortLived += procSample.shortLived;
+			
+			if (!user || system) {
+				printSectionLine();
+				printf("### Process events ### (%s)\n", procSample.polled ? "polling /proc" : "netlink proc connector");
+				printf(" forks/s = %.2f  execs/s = ", procSample.forks / procSample.interval);
+				if (procSample.polled) printf("n/a");
+				else printf("%.2f", procSample.execs / procSample.interval);
+				printf("  exits/s = %.2f  new threads/s = ", procSample.exits / procSample.interval);
+				if (procSample.polled) printf("n/a\n");
+				else printf("%.2f\n", procSample.threads / procSample.interval);
+				printf(" short-lived (<%.0fs) = %d (%ld total)%s\n", SHORTLIVED, procSample.shortLived, totalShortLived, procSample.polled ? ", shorter than a sample unseen" : "");
+				printf(" live processes = %d\n", procSample.live);
+			}
+		}
+		
+		/* Print hottest interrupt sources */
+		if (irqs) {
+			IrqSample irqSample;
+			if (read(irqFD[0], &irqSample, sizeof(IrqSample)) <= 0) {
+				fprintf(stderr, "Could not read interrupt counters from pipe\n");
+				exit(1);
+			}
+			
+			if (!user || system) {
+				printSectionLine();
+				printf("### Interrupts ### (hottest IRQ/CPU pairs of %d CPUs)\n", irqSample.cpus);
+				printf(" irqs/s = %.2f  softirqs/s = %.2f\n", irqSample.irqRate, irqSample.softirqRate);
+				for (int k = 0; k < irqSample.count; k++) {
+					printf("  CPU%-3d %-32s %10.2f/s\n", irqSample.top[k].cpu, irqSample.top[k].name, irqSample.top[k].rate);
+				}
+			}
+		}
+		
+		if (i == 0) {
+			fflush(stdout);
+			firstFrameTime = getTimestamp() - startTime;
+		}
 	}
 	
-	// Sleep remaining time
-	sleep(delay - 1);
-	
 	// Close read end of pipes
 	if (close(memFD[0]) == -1 || close(userFD[0]) == -1 || close(cpuFD[0]) == -1) {
 		perror("close");
 	}
+	if ((procEvents && close(procFD[0]) == -1) || (irqs && close(irqFD[0]) == -1) || (sched && close(schedFD[0]) == -1)
+	    || (sockets && close(socketFD[0]) == -1) || (numa && close(numaFD[0]) == -1)) {
+		perror("close");
+	}
 	
 	/* GET SYSTEM INFORMATION */
 	struct utsname kernalInfo;
@@ -711,14 +1523,21 @@ int main(int argc, char **argv) {
 	printf(" System running since last reboot: %d days %s:%s:%s (%s:%s:%s)\n", daysUptime, hoursUpStr, minsUpStr, secsUpStr, totalHoursUpStr, minsUpStr, secsUpStr);
 	printSectionLine();
 	
+	// Print how quickly the monitor itself got output on screen
+	if (selfProfile) {
+		printf("### Self profile ###\n");
+		if (firstFrameTime >= 0) printf(" Time to first frame = %.2f ms\n", firstFrameTime * 1000);
+		printf(" Total run time = %.2f secs\n", getTimestamp() - startTime);
+		printSectionLine();
+	}
+	
 	// Free allocated memory
 	deleteMList(memoryHead);
 	deleteCList(cpuHead);
+	free(waitHeat);
 	
 	// Wait for children to terminate before terminating (shouldn't wait at all)
-	wait(NULL);
-	wait(NULL);
-	wait(NULL);	// since only 3 children created
+	for (int i = 0; i < children; i++) wait(NULL);
 	
 	return 0;
 }